@@ -1,11 +1,11 @@
 
 #pragma once
-#include <Arduino.h>
+#include "hal/hal.h"
+#include <math.h>       // Before the log() macro below
 #include <stdbool.h>
 #include <stdexcept>
 #include <stdio.h>
 #include <string>
-#include <EEPROM.h>
 
 
 // Dev
@@ -14,31 +14,97 @@
 #define DEBUG_LOOP_ENABLED 0                                        // Enter debug loop
 #define DEBUG_LOOP_PING 0                                           // Serial print (".") while in debug_loop, sometimes helps with connection     
 #define RESET_ALL 0                                                 // Resets all counters and await new code upload   
+#define MODEM_EARLY_START_ENABLED 1                                 // Power up the SIM800L on the other core while sensing
+#define ULP_LEAK_MONITOR_ENABLED 0                                  // ULP coprocessor watches the leak leg while asleep after a false positive, no timer wake
+#define BATTERY_ADC_ENABLED 0                                       // Battery voltage divider on PIN_BATTERY_ADC, shown in the diagnostic SMS
+#define SMS_PDU_MODE_ENABLED 1                                      // PDU mode SMS: precomputed alerts, concatenated diagnostics. Text mode otherwise
+#define UART_CAPTURE_ENABLED 0                                      // Timestamped modem UART traffic in a RAM ring, dumped from the debug menu ('u')
 
 // Setup
 constexpr const char* SMS_ALERT_ROW_0 = "WARNING!";                 // Alert sms first row
 constexpr const char* SMS_ALERT_ROW_1 = "Water leak detected!";     // Alert sms second row
 constexpr const char* SMS_DIAGNOSTIC_ROW_0 = "Status!";             // Diagnostic sms first row
 constexpr uint32_t CONNECTION_TIMEOUT = 45*1000;                    // Wait for GSM network connection (mS)
-constexpr uint32_t DEEPSLEEP_DURATION_LONG = 2*60*60;               // Deepsleep after waterleak is detected (S)
-constexpr uint32_t DEEPSLEEP_DURATION_SHORT = 10;                   // Deepsleep after false positive (S)
-constexpr uint16_t SERIAL_RESPONSE_TIMEOUT = 75;                    // Wait for serial response from SIM800L (mS)
-constexpr uint16_t MAX_SMS_UNTILL_EMPTY_SIMCARD = 50;               // How many sms can we send in total? (money/sms cost)
+constexpr uint32_t DEEPSLEEP_DURATION_LONG = 2*60*60;               // Deepsleep after the last alert of a leak, then power off (S)
+constexpr uint32_t REALERT_INTERVALS[] = { 2*60, 10*60, 30*60, 2*60*60 }; // Deepsleep before each re-check while the leak persists, the last one repeats (S)
+constexpr uint8_t REALERT_MAX = 5;                                  // Follow-up alerts per leak, each to every phone number
+constexpr uint32_t OUTBOX_RETRY_INTERVALS[] = { 60, 5*60, 20*60 };  // Deepsleep before each retry of an undelivered SMS, the last one repeats (S)
+constexpr uint8_t OUTBOX_MAX_ATTEMPTS = 5;                          // Sessions per message before it is given up
+constexpr uint32_t DEEPSLEEP_DURATION_SHORT = 10;                   // Deepsleep after false positive, without the ULP monitor (S)
+constexpr uint32_t MODEM_BOOT_TIMEOUT = 10*1000;                    // Upper bound for the SIM800L to answer after power on (mS)
+constexpr uint32_t MODEM_PROBE_INTERVAL = 200;                      // "AT" probe interval while the SIM800L boots (mS)
+constexpr uint32_t MODEM_STEP_INTERVAL = 10;                        // Between modem state machine steps, also the URC latency (mS)
+constexpr uint32_t REGISTRATION_POLL_MIN = 250;                     // First AT+CREG? query interval, again after every change (mS)
+constexpr uint32_t REGISTRATION_POLL_MAX = 4000;                    // AT+CREG? query interval backs off up to this while nothing changes (mS)
+constexpr uint32_t AT_TIMEOUT_DEFAULT = 1000;                       // Upper bound for a SIM800L command response (mS)
+constexpr uint32_t AT_TIMEOUT_SMS_PROMPT = 5*1000;                  // Upper bound for the "> " prompt after AT+CMGS (mS)
+constexpr uint32_t AT_TIMEOUT_SMS_SEND = 60*1000;                   // Upper bound for the +CMGS acknowledgement (mS)
+constexpr float LEAK_ADC_DRY = 0;                                   // Expected ADC reading, dry sensor
+constexpr float LEAK_ADC_WET = 10;                                  // Expected ADC reading, smallest leak to detect (default of each probe)
+constexpr float LEAK_ADC_NOISE = 4;                                 // Standard deviation of a single ADC reading
+constexpr float LEAK_FALSE_ALARM_RATE = 0.001;                      // Accepted probability of a dry sensor read as a leak
+constexpr float LEAK_MISS_RATE = 0.001;                             // Accepted probability of a leak read as dry
+constexpr uint16_t LEAK_MIN_SAMPLES = 32;                           // Before any decision, at least the old 25 mS average (a multiple of the 4 sample scan block)
+constexpr uint16_t LEAK_MAX_SAMPLES = 64;                           // Undecided after this many: mean against the midpoint
+constexpr uint32_t LEAK_SAMPLE_INTERVAL = 1000;                     // Between leak ADC samples, far enough apart for the noise to be independent (uS)
+constexpr uint16_t ULP_LEAK_COUNT = 3;                              // Consecutive ULP readings above the dry/wet midpoint that wake the cores
+constexpr uint32_t ULP_LEAK_INTERVAL = 100*1000;                    // Between ULP leak readings while asleep (uS)
+constexpr uint8_t MODEM_TASK_CORE = 0;                              // Core for the SIM800L power up task (setup() runs on core 1)
+constexpr uint32_t MODEM_TASK_STACK_SIZE = 4096;                    // Stack of the SIM800L power up task (Bytes)
+constexpr const char* JOURNAL_PARTITION = "journal";               // Counter journal flash partition (partitions.csv)
+constexpr const char* EVENTS_PARTITION = "events";                  // Boot event log flash partition (partitions.csv)
+constexpr size_t PERSISTENT_STORE_SIZE = 128;                       // Every user opens the store with this size, it is truncated otherwise (Bytes)
+constexpr int NETWORK_CACHE_ADDRESS = 16;                           // Registration cache in the persistent store, after the old one byte counters
+constexpr uint32_t AT_TIMEOUT_REGISTER_HINT = 20*1000;              // Upper bound for AT+COPS=4 on the cached operator (mS)
+constexpr uint32_t MODEM_BAUD_RATE = 115200;                        // UART rate set with AT+IPR, the SIM800L keeps it across power cuts (Baud)
+constexpr uint32_t MODEM_BAUD_RATE_DEFAULT = 9600;                  // Until a rate is cached, the SIM800L auto-bauds out of the box (Baud)
+constexpr uint32_t MODEM_BAUD_RECOVERY_TIME = 4*1000;               // No answer at the cached rate by then: probe the other rates in turn (mS)
+constexpr uint32_t AT_TIMEOUT_CFUN = 10*1000;                       // Upper bound for AT+CFUN (mS)
+constexpr float MODEM_SLEEP_CURRENT = 1.2;                          // SIM800L registered, sleeping between pagings (AT+CSCLK=2) (mA)
+constexpr float MODEM_MINIMUM_CURRENT = 0.7;                        // SIM800L radio off (AT+CFUN=0), sleeping (mA)
+constexpr float MODEM_REATTACH_CHARGE = 150;                        // SIM800L radio on (AT+CFUN=1) until registered (mAs)
+constexpr float MODEM_COLD_START_CHARGE = 600;                      // SIM800L power on until registered (mAs)
+constexpr float ENERGY_CPU_CURRENT = 40;                            // ESP32 awake, radios off (mA)
+constexpr float ENERGY_DEEPSLEEP_CURRENT = 0.15;                    // ESP32 deep sleep and board quiescent, SIM800L cut (mA)
+constexpr float ENERGY_MODEM_CURRENT = 25;                          // SIM800L powered, booting, registering or idle on average (mA)
+constexpr float ENERGY_MODEM_SEND_CURRENT = 180;                    // SIM800L sending an SMS, TX bursts averaged, on top of the above (mA)
+constexpr float ENERGY_LED_CURRENT = 12;                            // WS2812B lit (mA)
+constexpr float ENERGY_ADC_CURRENT = 2;                             // ADC and the leak leg while sampling (mA)
+constexpr float BATTERY_CAPACITY = 2500;                            // Usable, reset the counters (RESET_ALL) on a battery swap (mAh)
+constexpr float BATTERY_ADC_SCALE = 2 * 3.3 / 4095;                 // ADC counts to battery volts, 1:2 divider (V)
+constexpr size_t SMS_DIAGNOSTIC_MAX_PARTS = 3;                      // Concatenated parts of one diagnostic SMS (PDU mode)
+constexpr uint16_t MAX_SMS_UNTILL_EMPTY_SIMCARD = 50;               // How many sms can we send in total? (money/sms cost), further sends are skipped
 constexpr uint64_t DEEPSLEEP_uS_TO_S_FACTOR = 1000000;              // Factor
 
 // Physical I/O
 #define PIN_CIRCUIT_POWER_SWITCH 19                                 // Pull HIGH to turn off ALL power (latching circuit)
 #define PIN_SIM800L_POWER_SWITCH 26                                 // Turn on/off power to the SIM800L module 
 #define PIN_TEST_BUTTON 13                                          // Input push button
-#define PIN_WATERLEAK_DETECT 4                                      // Input (third conductive leg) to detect water leakage
+#define PIN_WATERLEAK_DETECT 4                                      // Input (third conductive leg) to detect water leakage, the first probe
+#define PIN_BATTERY_ADC 34                                          // Optional battery voltage divider (ADC1, input only)
 #define PIN_LED 23                                                  // Datapin WS2812B led (SPI MOSI)
 #define PIN_SIM800L_RX 17                                           // ESP32 hardware serial 2 RX
 #define PIN_SIM800L_TX 16                                           // ESP32 hardware serial 2 TX
 
+// Leak probes, sampled together in one pass and named in the alert sms. Each leg needs a pin
+// with an internal pulldown (ADC1: gpio 32, 33) and a diode into the power latch
+struct LeakProbe {
+    uint8_t pin;
+    float wet_mean;                                                 // Expected ADC reading, smallest leak to detect on this probe
+    const char* label;                                              // Alert sms third row, short
+};
+constexpr LeakProbe LEAK_PROBES[] = {
+    { PIN_WATERLEAK_DETECT, LEAK_ADC_WET, "Sensor" },               // The ULP monitor watches the first probe
+    // { 32, LEAK_ADC_WET, "Boiler" },
+    // { 33, LEAK_ADC_WET, "Washing machine" },
+};
+constexpr size_t NUM_OF_LEAK_PROBES = sizeof(LEAK_PROBES) / sizeof(LEAK_PROBES[0]);
+static_assert(NUM_OF_LEAK_PROBES >= 1 && NUM_OF_LEAK_PROBES <= 8, "1 to 8 leak probes, one bit each");
+
 // Print toggle
 #if USB_SERIAL_ENABLED
-    #define log(...) Serial.printf(__VA_ARGS__)
-    #define STOP log("\n-----  Stop right there criminal scum!  ----- \n"); while (1) { delay(1); }
+    #define log(...) hal::console_printf(__VA_ARGS__)
+    #define STOP log("\n-----  Stop right there criminal scum!  ----- \n"); while (1) { hal::delay(1); }
 #else
     #define log(...)
     #define STOP
@@ -51,6 +117,23 @@ enum class SMSType : uint8_t {
     None
 };
 
+// Outcome of a send session, the caller decides what follows (re-alert sleep, power off)
+enum class SendResult : uint8_t {
+    Delivered,  // Or nothing queued
+    Pending,    // Retried from a later wake (outbox)
+    GivenUp     // Out of attempts or skipped (quota, SMS disabled)
+};
+
+enum class SmsStatus : uint8_t {
+    Pending,
+    Sent,
+    Skipped,    // SMS disabled or per boot limit reached
+    NoPrompt,   // No "> " after AT+CMGS
+    Rejected,   // ERROR / +CMS ERROR
+    Timeout,
+    NoNetwork   // Not registered (no modem, no SIM card, denied), not attempted
+};
+
 enum class Color : uint8_t {
     Orange,
     Green,
@@ -62,5 +145,7 @@ enum class Color : uint8_t {
 enum MemAddr : int {
     BootCount,
     SmsSent,
-    NumOfMemAddr  // Num of items. Well, it only grew to two
+    ChargeUsed,   // Modelled battery drain since the counters were reset (uAh)
+    AlertCharge,  // Of the last alert boot and its sleep (uAh)
+    NumOfMemAddr  // Num of items
 };
@@ -0,0 +1,61 @@
+#pragma once
+#include "config.h"
+#include "core/ring_buffer.h"
+#include <atomic>
+#include <string_view>
+
+
+// Final result of an AT command
+enum class AtResult : uint8_t {
+    Ok,
+    Error,
+    CmsError,
+    Prompt,
+    Timeout,
+    Aborted
+};
+
+
+class AtEngine {
+public:
+    using UrcHandler = void (*)(const char* urc);
+
+    explicit AtEngine(hal::Uart& stream) : _stream(stream) {}
+
+    AtResult command(const char* command, uint32_t timeout_ms = AT_TIMEOUT_DEFAULT);
+    AtResult await_result(uint32_t timeout_ms);
+    void send(const char* command);
+    void write(const uint8_t* data, size_t size);
+    bool check(AtResult& result);
+    void abandon();
+    bool is_pending() const { return _is_pending; }
+    void poll();
+    void set_urc_handler(UrcHandler handler);
+    void set_abort_flag(const std::atomic<bool>* flag);
+    std::string_view response() const;
+
+    static constexpr size_t RX_SIZE = 256;
+    static constexpr size_t LINE_SIZE = 128;
+    static constexpr size_t RESPONSE_SIZE = 256;
+
+private:
+    hal::Uart& _stream;
+    UrcHandler _urc_handler = nullptr;
+    const std::atomic<bool>* _abort_flag = nullptr;
+    char _command[LINE_SIZE] = {};     // Copy of the pending command, empty once answered
+    bool _is_pending = false;          // Sent, final result not seen yet
+    RingBuffer<RX_SIZE> _rx;
+    char _line[LINE_SIZE] = {};
+    size_t _line_len = 0;
+    char _response[RESPONSE_SIZE] = {};
+    size_t _response_len = 0;
+
+    void fill_rx();
+    bool process_rx(AtResult& result);
+    bool process_byte(char c, AtResult& result);
+    bool process_line(AtResult& result);
+    bool is_command_echo(const char* line) const;
+    bool is_command_response(const char* line) const;
+    bool is_urc(const char* line) const;
+    void append_response(const char* line);
+};
@@ -0,0 +1,50 @@
+#pragma once
+#include "config.h"
+
+// Append-only journal of 32-bit counters in a raw flash partition. Every change is a
+// 16 byte record (sequence, counter, value, CRC) programmed into the next free slot,
+// no erase. Sectors are used as a ring: each one starts with a snapshot of all
+// counters, so a full sector is compacted by moving on and the oldest sector is
+// only erased when the ring comes back to it. The newest sector holds every value
+
+
+class CounterJournal {
+public:
+    static constexpr size_t NUM_OF_COUNTERS = MemAddr::NumOfMemAddr;
+
+    bool mount(const char* label);
+    bool is_formatted() const;
+    bool format(const uint32_t* values);
+    uint32_t get(int counter) const;
+    bool commit(const uint32_t* values);
+    uint32_t get_sequence() const;
+
+private:
+    struct Record {
+        uint32_t sequence;      // Grows with every record, 0xFFFFFFFF when erased
+        uint16_t counter;
+        uint16_t reserved;
+        uint32_t value;
+        uint32_t crc;           // CRC-32 of the fields above
+    };
+    static_assert(sizeof(Record) == 16, "Record must stay 16 bytes, 256 per sector");
+
+    static constexpr size_t RECORDS_PER_SECTOR = hal::FLASH_SECTOR_SIZE / sizeof(Record);
+    static constexpr size_t SCAN_RECORDS = 16;         // Records read per flash access
+
+    hal::Flash _flash;
+    uint32_t _values[NUM_OF_COUNTERS] = {};
+    size_t _num_of_sectors = 0;
+    size_t _sector = 0;         // Head sector
+    size_t _slot = 0;           // Next free slot in the head sector
+    uint32_t _sequence = 0;     // Of the next record
+    bool _is_formatted = false;
+
+    Record make_record(uint16_t counter, uint32_t value);
+    bool write_records(const Record* records, size_t count);
+    bool start_sector(size_t sector);
+    uint32_t scan_sector(size_t sector, uint32_t& seen, bool only_unseen, size_t* free_slot);
+    bool is_sector_erased(size_t sector);
+    static bool is_valid(const Record& record);
+    static bool is_erased(const Record& record);
+};
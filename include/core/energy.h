@@ -0,0 +1,28 @@
+#pragma once
+#include "config.h"
+
+// Modelled battery drain: time spent in each phase of a boot times the ENERGY_* currents
+// (config.h), plus the deep sleep that follows. Committed once per boot into the ChargeUsed
+// counter, so the total survives power cuts. Reported in the diagnostic SMS
+
+
+namespace energy {
+    enum class Phase : uint8_t {
+        Awake,          // CPU running since reset
+        ModemOn,        // SIM800L powered, power_on() to power_off()
+        ModemSending,   // AT+CMGS until acknowledged, on top of ModemOn
+        Led,
+        Adc,            // Leak leg sampling, on top of Awake
+        Sleep,          // The deep sleep to come, see add_sleep()
+        NumOfPhases
+    };
+
+    void start(Phase phase);
+    void stop(Phase phase);
+    void add_sleep(uint32_t duration_s, float current);    // Current in mA
+    float get_charge(Phase phase);                          // mAh this boot so far
+    float get_boot_charge();
+    void commit(bool is_alert);
+    float read_battery_voltage();                           // 0 without BATTERY_ADC_ENABLED
+    void format_summary(char* buffer, size_t size);
+}
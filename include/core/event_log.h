@@ -0,0 +1,49 @@
+#pragma once
+#include "config.h"
+
+// Per boot history in the "events" flash partition. One fixed size binary record per
+// boot, filled in while the boot runs and appended with a single write at shutdown.
+// Sectors form a ring, the oldest is erased when the ring comes back to it. Decoded
+// on the host from a partition dump (native runner --decode-events)
+
+
+namespace event_log {
+    constexpr uint8_t VERSION = 2;          // 2: leak_probes, reserved before. Version 1 records still read
+    constexpr size_t MAX_RECIPIENTS = 4;
+
+    // Trace spans kept per boot, summed by name
+    constexpr const char* PHASE_NAMES[] = { "hw", "leak", "modem", "net", "sms", "commit" };
+    constexpr size_t NUM_OF_PHASES = sizeof(PHASE_NAMES) / sizeof(PHASE_NAMES[0]);
+
+    struct Recipient {
+        uint8_t status;             // SmsStatus
+        uint8_t reference;          // <mr> (mod 256), 255 when unknown
+        uint16_t duration_ms;       // AT+CMGS until acknowledged
+    };
+
+    struct Record {
+        uint32_t sequence;          // Boot number, 0xFFFFFFFF when erased
+        uint8_t version;
+        uint8_t wake_cause;         // hal::WakeupCause
+        uint8_t leak_decision;      // LeakDecision
+        uint8_t sms_type;           // SMSType sent this boot
+        uint16_t adc_mean;          // Leak leg closest to wet, ADC counts
+        uint16_t adc_max;
+        uint8_t adc_samples;
+        uint8_t csq;                // Raw +CSQ rssi 0..31, 99 unknown
+        uint16_t modem_ready_ms;    // SIM800L power on to the first "OK"
+        uint16_t phase_ms[NUM_OF_PHASES];
+        char operator_name[8];      // Null terminated, cut at 7 chars
+        Recipient recipients[MAX_RECIPIENTS];
+        uint32_t awake_ms;          // Until the record was written
+        uint8_t num_of_recipients;
+        uint8_t leak_probes;        // Wet, bit per LEAK_PROBES entry
+        uint8_t reserved[2];
+        uint32_t crc;               // CRC-32 of the fields above
+    };
+    static_assert(sizeof(Record) == 64, "Record must stay 64 bytes, 64 per sector");
+
+    Record& current();
+    bool append();
+    bool is_valid(const Record& record);
+}
@@ -2,45 +2,153 @@
 #pragma once
 #include "config.h"
 #include "secrets.h"
-#include <HardwareSerial.h>
+#include "core/at_engine.h"
+#include "core/network_cache.h"
+#include "core/sms_pdu.h"
+#include "core/sms_text.h"
+
+
+// Modem lifecycle, advanced by GsmModule::step() without blocking
+enum class ModemState : uint8_t {
+    Off,
+    Booting,        // Powered, probing "AT"
+    SimReady,       // Answered, SIM card read, waiting for the network
+    Registered,     // +CREG home network or roaming
+    Sending,
+    Done,
+    Failed,         // See get_failure()
+    NumOfStates
+};
+
+// Kept through the deep sleep between re-alerts, see GsmModule::standby()
+enum class ModemStandby : uint8_t {
+    Off,            // Power cut, cold start on the next wake
+    Sleep,          // Registered, sleeps while the UART is quiet (AT+CSCLK=2)
+    Minimum         // Radio off (AT+CFUN=0) and sleeping, registers again on wake
+};
+
+enum class ModemFailure : uint8_t {
+    None,
+    NoModem,        // No answer within MODEM_BOOT_TIMEOUT
+    NoSim,          // AT+CCID failed
+    Denied,         // Registration denied (+CREG stat 3)
+    NoNetwork,      // Not registered within CONNECTION_TIMEOUT
+    NotSent         // Registered, not every SMS went out
+};
+
+
+// Outcome of one recipient
+struct SmsReceipt {
+    SmsStatus status = SmsStatus::Pending;
+    int reference = -1;         // <mr> from "+CMGS: <mr>"
+    uint32_t duration_ms = 0;   // AT+CMGS until acknowledged
+};
 
 
 class GsmModule {
 public:
-    GsmModule() : GSM_serial(2) {}  // Use UART2 bus
-    HardwareSerial GSM_serial;      // Connection to SIM800L module: RX = gpio 16, TX = gpio 17
+    GsmModule() : GSM_serial(2), _at(GSM_serial) { _at.set_abort_flag(&_is_cancelled); }  // Use UART2 bus
+    hal::Uart GSM_serial;           // Connection to SIM800L module: RX = gpio 16, TX = gpio 17
 
     void begin(const SMSType sms_type = SMSType::None);
-    void send_message(const SMSType sms_type);
+    void begin_async();
+    void cancel_async();
+    SendResult send_message(const SMSType sms_type, uint8_t probes = 0);   // Alert: wet probes, bit per LEAK_PROBES entry
+    SendResult send_pending();                                              // Messages queued by earlier sessions (outbox)
     void flush_buffers();
     void flush_RX_buffer();
+    void standby(uint32_t duration_s);
     void power_off();
+    void step();
+    static ModemState get_state();
+    static ModemFailure get_failure();
+    static uint32_t get_state_ms(ModemState state);
+    static uint32_t get_time_to_ready();
+    static uint32_t get_baud_rate();
+    static ModemStandby get_standby();
+    static float get_standby_current();
+    static ModemStandby choose_standby(uint32_t duration_s);
+    static const SmsReceipt& get_receipt(int index);
+    static bool has_pending();
 
     // How many phone numbers are entered?
     constexpr static int NUM_OF_PHONES_TO_SMS = 
         sizeof(secret_phone_numbers) / sizeof(secret_phone_numbers[0]); 
 
+    // Diagnostic body, concatenated parts in PDU mode (may hold fewer when escapes are used)
+    constexpr static size_t DIAGNOSTIC_MAX_LENGTH = SMS_PDU_MODE_ENABLED ? 
+        SMS_DIAGNOSTIC_MAX_PARTS * sms_pdu::MAX_PART_SEPTETS : sms_text::MAX_LENGTH;
+
 private:
+    AtEngine _at;                   // AT command/response engine on GSM_serial
+    hal::Task _power_up_task;       // Speculative power up on the other core
+
     // Static members
-    static bool _is_sim800l_on;
+    static ModemState _state;
+    static ModemFailure _failure;
+    static std::atomic<bool> _is_cancelled;
+    static uint32_t _power_on_time;
+    static uint32_t _baud_rate;         // Current GSM_serial rate
+    static ModemStandby _standby;       // RTC memory, chosen for the coming deep sleep
+    static ModemStandby _resumed_from;  // Standby this power up started from
+    static uint32_t _state_start_time;
+    static uint32_t _state_ms[static_cast<size_t>(ModemState::NumOfStates)];
+    static int _state_span;             // Trace span of the current state
+    static uint32_t _request_time;      // Pending "AT" probe or registration hint sent
+    static uint32_t _next_poll_time;
+    static uint32_t _poll_interval;     // Registration queries, backs off while nothing changes
+    static int _registration;           // Last +CREG <stat>, -1 unknown
+    static bool _is_hint_sent;
+    static uint32_t _time_to_ready;
     static int _signal_strength;
-    static String _boot_counter;
-    static String _total_sms_sent; 
-    static std::string _model_name;
-    static std::string _network_operator;
+    static char _boot_counter[32];
+    static char _total_sms_sent[16]; 
+    static char _model_name[16];
+    static char _network_operator[24];
+    static char _trace_summary[96];
+    static char _energy_summary[48];
+    static char _diagnostic_body[DIAGNOSTIC_MAX_LENGTH + 2];
+    static size_t _diagnostic_length;
+    static uint8_t _concat_reference;   // Same for every part of one diagnostic
+    static uint8_t _alert_probes;       // Named in the alert
+    static SmsReceipt _receipts[NUM_OF_PHONES_TO_SMS];
+    static network_cache::Entry _cache;
+    static bool _is_sim_known;          // Same SIM card as the cached registration
+    static bool _is_operator_current;   // Cached operator confirmed this session (hint accepted or queried)
+    static bool _is_cache_dirty;
 
     // Methods
+    void connect(const SMSType sms_type);
+    static void power_up_task(void* module);
+    static void load_network_cache();
+    void power_on();
+    void run_until(ModemState target);
+    void enter(ModemState state);
+    void fail(ModemFailure failure);
+    void step_booting();
+    void step_registering();
+    void on_modem_ready();
+    void next_baud_rate();
+    void negotiate_baud_rate();
+    bool is_sim_ready() const;
     bool send_sms_guard();
-    bool send_sms(const SMSType sms_type, const char* phone_number);
-    bool is_GSM_connected();
+    SmsReceipt send_sms(const SMSType sms_type, int recipient);
+    SmsStatus submit(const char* command, const char* body, size_t size, SmsReceipt& receipt);
+    void query_registration();
+    bool send_registration_hint();
+    void check_sim(std::string_view ccid_response);
+    void update_network_cache();
     void get_diagnostic_details();
+    void format_diagnostic_body();
     int get_GSM_signal_strength();
-    void get_model_name(std::string& model_name);
-    void get_network_operator(std::string& operator_name);
-    bool get_network_operator_name(std::string& operator_name);
-    void get_serial_response(std::string& response, bool print = false, uint extra_delay = 0);
-    bool verify_serial_response(std::string& response);
-    bool send_serial_and_verify(const char* command, bool print = false, uint extra_delay = 0);
-    bool send_serial_and_verify(const char* command, std::string& response, bool print = false, uint extra_delay = 0);
-    int string_to_int(std::string& response);
+    void get_model_name(char* model_name, size_t size);
+    void get_network_operator(char* operator_name, size_t size);
+    bool get_network_operator_name(char* operator_name, size_t size);
+    bool send_serial_and_verify(const char* command, uint32_t timeout_ms = AT_TIMEOUT_DEFAULT);
+    bool send_serial_and_verify(const char* command, std::string_view& response, uint32_t timeout_ms = AT_TIMEOUT_DEFAULT);
+    void record_event(const SMSType sms_type);
+    static void handle_urc(const char* urc);
+    static int parse_registration(std::string_view response, bool is_urc);
+    static void copy_view(char* buffer, size_t size, std::string_view view);
+    int string_to_int(std::string_view text);
 };
@@ -3,22 +3,35 @@
 #include "config.h"
 #include "core/memory.h"
 #include "core/gsm_module.h"
-#include <NeoPixelBus.h>
 
 
 namespace hardware {        
+    // Time since reset of the first boot milestones, 0 until reached
+    struct BootProfile {
+        uint32_t latch_us;          // Power latch held (first GPIO write)
+        uint32_t decision_us;       // Leak test decided
+    };
+
+    void shutdown_on_idle_wakeup();
     void IRAM_ATTR begin_hardware(Memory* memory, GsmModule* sms);
     void begin_USB_serial();
     bool is_test_button_pressed();
     bool is_water_leak_detected();
+    uint8_t get_leak_probes();
+    bool start_leak_monitor();
     bool IRAM_ATTR woke_up_from_deepsleep();
-    void deepsleep(const uint32_t& sleep_duration_seconds);
+    bool is_realert_due();
+    bool is_retry_due();
+    uint32_t schedule_realert();
+    void end_realert();
+    void deepsleep(const uint32_t& duration_seconds);
     void peripherals_shutdown();
     void system_shutdown();
     void set_led_color(SMSType sms_type);
     void led_color(Color color);
     void led_blink(size_t times, Color color, uint delay_ms);
     void led_end();
-    RgbColor map_color_to_RGB(Color color);
+    hal::Rgb map_color_to_RGB(Color color);
     void error();
+    const BootProfile& get_boot_profile();
 };
@@ -0,0 +1,51 @@
+#pragma once
+#include "config.h"
+
+// Early exit leak test on ADC samples of the third leg. Wald's sequential probability
+// ratio test between "dry" and "wet" readings: stops as soon as either hypothesis
+// reaches the requested error rates. The bounds hold for independent samples only, so
+// no decision is taken before min_samples (spaced LEAK_SAMPLE_INTERVAL apart)
+
+
+enum class LeakDecision : uint8_t {
+    Undecided,
+    Leak,
+    NoLeak
+};
+
+
+struct LeakThresholds {
+    float dry_mean = LEAK_ADC_DRY;
+    float wet_mean = LEAK_ADC_WET;
+    float noise = LEAK_ADC_NOISE;
+    float false_alarm_rate = LEAK_FALSE_ALARM_RATE;
+    float miss_rate = LEAK_MISS_RATE;
+    uint16_t min_samples = LEAK_MIN_SAMPLES;
+    uint16_t max_samples = LEAK_MAX_SAMPLES;
+};
+
+
+class LeakClassifier {
+public:
+    explicit LeakClassifier(const LeakThresholds& thresholds = LeakThresholds());
+
+    LeakDecision add(uint16_t sample);
+    LeakDecision get_decision() const;
+    uint16_t get_samples() const;
+    float get_mean() const;
+    uint16_t get_max() const;
+
+private:
+    LeakThresholds _thresholds;
+    float _midpoint;            // Between the dry and wet means, the fallback threshold
+    float _scale;               // Log likelihood ratio per ADC count above the midpoint
+    float _upper;               // Accept "leak" at or above
+    float _lower;               // Accept "no leak" at or below
+    float _sample_min;          // Samples are clipped, a single spike cannot decide
+    float _sample_max;
+    float _ratio = 0;
+    uint32_t _sum = 0;
+    uint16_t _max = 0;
+    uint16_t _samples = 0;
+    LeakDecision _decision = LeakDecision::Undecided;
+};
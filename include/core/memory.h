@@ -1,6 +1,6 @@
-
 #pragma once
 #include "config.h"
+#include "core/counter_journal.h"
 #include <type_traits>
 
 
@@ -8,27 +8,36 @@ class Memory {
 public:
     Memory() = default;
 
-    void begin();
+    static void begin();
     void end();
+    static bool flush();
     static bool get_has_eeprom_failed();
-    static void increment_eeprom_count(int address, int amount = 1, bool bootup_delay = false); 
+    static bool has_staged_counters();
+    static void increment_eeprom_count(int address, int amount = 1); 
     static void reset_eeprom_count(int address);
-    static void get_eeprom_counter_String(String& str, const int address);
+    static void get_eeprom_counter_string(char* buffer, size_t size, const int address);
     
     template <typename Type>
     static Type get_eeprom_count(int address) {
-        static_assert(std::is_integral_v<Type> || std::is_same_v<Type, String>,
-            "Type must be Arduino String or integral");
+        static_assert(std::is_integral_v<Type>, "Type must be integral");
 
+        mount_once();
         if (_has_eeprom_failed) {
             return Type(0); 
         } else if (address == MemAddr::SmsSent) {
-            return Type(EEPROM.read(address) + 1);
+            return Type(_counters[address] + 1);
         } else {
-            return Type(EEPROM.read(address)); 
+            return Type(_counters[address]); 
         }
     }
 
 private:
+    static CounterJournal _journal;
+    static uint32_t _counters[MemAddr::NumOfMemAddr];  // Write-back view, flushed once by end()
     static bool _has_eeprom_failed;
+    static bool _is_mounted;
+    static void mount_once();
+    static void stage();
+    static void recover_staged();
+    static void import_eeprom(uint32_t* values);
 };
@@ -0,0 +1,23 @@
+#pragma once
+#include "config.h"
+
+// Last successful network registration, kept in the persistent store across power cuts.
+// Hints AT+COPS on the next attach and stands in for the identity queries while the
+// same SIM card is in (matched by CCID). The UART rate belongs to the module, kept on SIM swaps
+
+
+namespace network_cache {
+    struct Entry {
+        uint32_t magic;
+        char ccid[24];              // SIM card the entry belongs to
+        char model[16];             // ATI, "SIMXXX RXX.XX"
+        char operator_name[24];     // +COPS long alphanumeric name, empty when unknown
+        uint8_t access_technology;  // +COPS <AcT>, 0xFF when not reported (SIM800L: GSM only)
+        uint8_t reserved[3];
+        uint32_t baud_rate;         // AT+IPR rate the module answered at, 0 when unknown
+        uint32_t crc;               // CRC-32 of the fields above
+    };
+
+    bool load(Entry& entry);
+    bool save(const Entry& entry);
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include "config.h"
+#include "secrets.h"
+
+// Messages not yet delivered to every recipient, kept in RTC memory. Retried on later timer
+// wakes with growing intervals (OUTBOX_RETRY_INTERVALS) until delivered, or given up after
+// OUTBOX_MAX_ATTEMPTS sessions. RTC_NOINIT_ATTR: survives deep sleep and resets (watchdog,
+// panic), the next send session picks it up. Not a power cut, without the timer nothing
+// would wake to retry anyway
+
+
+namespace outbox {
+    constexpr size_t CAPACITY = 4;
+    constexpr size_t NUM_OF_RECIPIENTS = sizeof(secret_phone_numbers) / sizeof(secret_phone_numbers[0]);
+
+    struct Message {
+        SMSType sms_type;
+        uint8_t probes;                         // Alert: wet probes, bit per LEAK_PROBES entry
+        uint8_t attempts;                       // Sessions tried so far
+        SmsStatus status[NUM_OF_RECIPIENTS];    // Sent and Skipped are final, the rest is retried
+    };
+
+    void push(SMSType sms_type, uint8_t probes);    // Replaces a pending message of the same type
+    size_t size();
+    Message& at(size_t index);                      // Oldest first
+    bool is_final(SmsStatus status);
+    void end_session();                             // Drops delivered and exhausted messages
+    uint32_t get_retry_delay();                     // Until the next attempt (S)
+}
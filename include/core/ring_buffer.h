@@ -0,0 +1,35 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+
+// Fixed capacity byte FIFO, no heap. Indices run freely and wrap through the mask
+template <size_t Capacity>
+class RingBuffer {
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    bool push(uint8_t byte) {
+        if (is_full()) { return false; } // Dropped
+        _data[_head++ & MASK] = byte;
+        return true;
+    }
+
+    bool pop(uint8_t& byte) {
+        if (is_empty()) { return false; }
+        byte = _data[_tail++ & MASK];
+        return true;
+    }
+
+    size_t size() const { return _head - _tail; }
+    size_t space() const { return Capacity - size(); }
+    bool is_empty() const { return _head == _tail; }
+    bool is_full() const { return size() == Capacity; }
+    void clear() { _tail = _head; }
+
+private:
+    static constexpr size_t MASK = Capacity - 1;
+    uint8_t _data[Capacity] = {};
+    size_t _head = 0;
+    size_t _tail = 0;
+};
@@ -0,0 +1,188 @@
+#pragma once
+#include "config.h"
+#include "secrets.h"
+#include "core/sms_text.h"
+#include <array>
+
+// SMS-SUBMIT PDUs (3GPP TS 23.040) in the GSM 7-bit default alphabet (TS 23.038), hex encoded
+// for AT+CMGS in PDU mode. Alert PDUs are built at compile time, one per probe and recipient.
+// Longer bodies are split into concatenated parts, shown as one message by the phone
+
+
+namespace sms_pdu {
+    constexpr size_t MAX_SEPTETS = 160;             // Single part
+    constexpr size_t MAX_PART_SEPTETS = 153;        // After the concatenation header (7 septets)
+    constexpr size_t MAX_ADDRESS_DIGITS = 20;
+    constexpr size_t MAX_TPDU_LENGTH = 4 + MAX_ADDRESS_DIGITS / 2 + 3 + 140;
+    constexpr size_t MAX_HEX_LENGTH = 2 + 2 * MAX_TPDU_LENGTH + 1;
+    constexpr uint8_t ESCAPE = 0x1B;                // Next septet from the extension table
+
+    struct Pdu {
+        char hex[MAX_HEX_LENGTH] = {};  // SMSC "00" (default), TPDU in hex and Ctrl-Z. Not null terminated
+        size_t size = 0;                // Bytes to write after the "> " prompt
+        uint8_t tpdu_length = 0;        // AT+CMGS=<length>, the SMSC octet excluded
+    };
+
+    // Septets of one character (1, or 2 with the escape), '?' when the alphabet lacks it
+    constexpr size_t to_septets(char c, uint8_t* septets) {
+        switch (c) {
+            case '@':   septets[0] = 0x00; return 1;
+            case '$':   septets[0] = 0x02; return 1;
+            case '_':   septets[0] = 0x11; return 1;
+            case '^':   septets[0] = ESCAPE; septets[1] = 0x14; return 2;
+            case '{':   septets[0] = ESCAPE; septets[1] = 0x28; return 2;
+            case '}':   septets[0] = ESCAPE; septets[1] = 0x29; return 2;
+            case '\\':  septets[0] = ESCAPE; septets[1] = 0x2F; return 2;
+            case '[':   septets[0] = ESCAPE; septets[1] = 0x3C; return 2;
+            case '~':   septets[0] = ESCAPE; septets[1] = 0x3D; return 2;
+            case ']':   septets[0] = ESCAPE; septets[1] = 0x3E; return 2;
+            case '|':   septets[0] = ESCAPE; septets[1] = 0x40; return 2;
+            case '`':   septets[0] = '?'; return 1;
+            default:    break;
+        }
+
+        // Shared with ASCII: '\n', '\r', space to '~' apart from the above
+        const bool is_shared = (c == '\n' || c == '\r' || (c >= ' ' && c <= '~'));
+        septets[0] = is_shared ? static_cast<uint8_t>(c) : '?';
+        return 1;
+    }
+
+    constexpr size_t count_septets(const char* text, size_t length) {
+        size_t count = 0;
+        for (size_t i = 0; i < length; i++) {
+            uint8_t septets[2] = {};
+            count += to_septets(text[i], septets);
+        }
+        return count;
+    }
+
+    // Characters that fit in one part from text on, an escape pair is never split
+    constexpr size_t fit_part(const char* text, size_t length, size_t max_septets) {
+        size_t count = 0;
+        size_t used = 0;
+        while (count < length) {
+            uint8_t septets[2] = {};
+            const size_t size = to_septets(text[count], septets);
+            if (used + size > max_septets) { break; }
+            used += size;
+            count++;
+        }
+        return count;
+    }
+
+    constexpr size_t count_parts(const char* text, size_t length) {
+        if (count_septets(text, length) <= MAX_SEPTETS) { return 1; }
+
+        size_t parts = 0;
+        for (size_t start = 0; start < length; parts++) {
+            start += fit_part(text + start, length - start, MAX_PART_SEPTETS);
+        }
+        return parts;
+    }
+
+    // One part. reference/part/parts only matter when parts > 1 (1 based part)
+    constexpr Pdu encode(const char* number, const char* text, size_t length,
+                         uint8_t reference = 0, uint8_t part = 1, uint8_t parts = 1) {
+        uint8_t tpdu[MAX_TPDU_LENGTH] = {};
+        size_t index = 0;
+        const bool is_concatenated = (parts > 1);
+
+        // SMS-SUBMIT, no validity period, user data header when concatenated. Reference set by the modem
+        tpdu[index++] = is_concatenated ? 0x41 : 0x01;
+        tpdu[index++] = 0x00;
+
+        // Destination: digit count, international (+) or unknown, swapped semi-octets padded with F
+        const bool is_international = (number[0] == '+');
+        uint8_t digits = 0;
+        for (const char* c = number; *c != '\0' && digits < MAX_ADDRESS_DIGITS; c++) {
+            if (*c < '0' || *c > '9') { continue; }
+
+            const size_t octet = index + 2 + digits / 2;
+            tpdu[octet] = (digits % 2 == 0) ? static_cast<uint8_t>(0xF0 | (*c - '0'))
+                : static_cast<uint8_t>((tpdu[octet] & 0x0F) | ((*c - '0') << 4));
+            digits++;
+        }
+        tpdu[index++] = digits;
+        tpdu[index++] = is_international ? 0x91 : 0x81;
+        index += (digits + 1) / 2;
+
+        // Protocol identifier, default alphabet
+        tpdu[index++] = 0x00;
+        tpdu[index++] = 0x00;
+
+        // User data length in septets, the header counts as 7 (6 octets and a fill bit)
+        const size_t header_septets = is_concatenated ? 7 : 0;
+        tpdu[index++] = static_cast<uint8_t>(header_septets + count_septets(text, length));
+        const size_t user_data = index;
+        if (is_concatenated) {
+            const uint8_t header[] = { 0x05, 0x00, 0x03, reference, parts, part };
+            for (uint8_t octet : header) { tpdu[index++] = octet; }
+        }
+
+        // Septets packed LSB first, 8 in 7 octets
+        size_t bit = header_septets * 7;
+        for (size_t i = 0; i < length; i++) {
+            uint8_t septets[2] = {};
+            const size_t count = to_septets(text[i], septets);
+
+            for (size_t s = 0; s < count; s++) {
+                const size_t octet = user_data + bit / 8;
+                const size_t shift = bit % 8;
+                tpdu[octet] |= static_cast<uint8_t>(septets[s] << shift);
+                if (shift > 1) {
+                    tpdu[octet + 1] |= static_cast<uint8_t>(septets[s] >> (8 - shift));
+                }
+                bit += 7;
+            }
+        }
+        index = user_data + (bit + 7) / 8;
+
+        // Hex, behind the default SMSC
+        constexpr const char* HEX = "0123456789ABCDEF";
+        Pdu pdu;
+        pdu.hex[pdu.size++] = '0';
+        pdu.hex[pdu.size++] = '0';
+        for (size_t i = 0; i < index; i++) {
+            pdu.hex[pdu.size++] = HEX[tpdu[i] >> 4];
+            pdu.hex[pdu.size++] = HEX[tpdu[i] & 0x0F];
+        }
+        pdu.hex[pdu.size++] = sms_text::CTRL_Z;
+        pdu.tpdu_length = static_cast<uint8_t>(index);
+        return pdu;
+    }
+
+    // Alert naming the wet probes, cut to a single part. Ctrl-Z of the text mode body left out
+    constexpr Pdu encode_alert(const char* number, uint8_t probes) {
+        const sms_text::Body body = sms_text::make_alert(probes);
+        return encode(number, body.text, fit_part(body.text, body.size - 1, MAX_SEPTETS));
+    }
+
+    constexpr bool is_alert_single_part(uint8_t probes) {
+        const sms_text::Body body = sms_text::make_alert(probes);
+        return count_septets(body.text, body.size - 1) <= MAX_SEPTETS;
+    }
+
+    constexpr bool are_alerts_single_part() {
+        for (size_t probe = 0; probe < NUM_OF_LEAK_PROBES; probe++) {
+            if (!is_alert_single_part(1 << probe)) { return false; }
+        }
+        return true;
+    }
+    static_assert(are_alerts_single_part(), "Alert SMS does not fit in a single SMS (160 septets)");
+
+    // Ready made for a single wet probe, the usual case. encode_alert() for several
+    constexpr size_t NUM_OF_RECIPIENTS = sizeof(secret_phone_numbers) / sizeof(secret_phone_numbers[0]);
+    using AlertPdus = std::array<std::array<Pdu, NUM_OF_RECIPIENTS>, NUM_OF_LEAK_PROBES>;
+
+    constexpr AlertPdus make_alerts() {
+        AlertPdus alerts = {};
+        for (size_t probe = 0; probe < NUM_OF_LEAK_PROBES; probe++) {
+            for (size_t i = 0; i < NUM_OF_RECIPIENTS; i++) {
+                alerts[probe][i] = encode_alert(secret_phone_numbers[i], 1 << probe);
+            }
+        }
+        return alerts;
+    }
+
+    inline constexpr AlertPdus ALERTS = make_alerts();   // One definition for every translation unit
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include "config.h"
+
+// SMS bodies, ready to be written after the "> " prompt in one go (Ctrl-Z included)
+
+
+namespace sms_text {
+    constexpr size_t MAX_LENGTH = 160;  // Single SMS, GSM 7-bit alphabet
+    constexpr char CTRL_Z = 26;         // Ends the body and sends
+
+    constexpr size_t length(const char* str) {
+        size_t size = 0;
+        while (str[size] != '\0') { size++; }
+        return size;
+    }
+
+    struct Body {
+        char text[MAX_LENGTH + 1] = {};     // Ctrl-Z included, not null terminated
+        size_t size = 0;
+    };
+
+    // Alert: rows separated by '\n'
+    constexpr size_t ALERT_LENGTH = length(SMS_ALERT_ROW_0) + 1 + length(SMS_ALERT_ROW_1);
+    static_assert(ALERT_LENGTH <= MAX_LENGTH, "Alert SMS does not fit in a single SMS (160 chars)");
+
+    // Third row: labels of the wet probes (bit per LEAK_PROBES entry), those that do not fit are left out
+    constexpr Body make_alert(uint8_t probes) {
+        Body body;
+        for (const char* c = SMS_ALERT_ROW_0; *c != '\0'; c++) { body.text[body.size++] = *c; }
+        body.text[body.size++] = '\n';
+        for (const char* c = SMS_ALERT_ROW_1; *c != '\0'; c++) { body.text[body.size++] = *c; }
+
+        bool is_first = true;
+        for (size_t i = 0; i < NUM_OF_LEAK_PROBES; i++) {
+            const size_t label_length = length(LEAK_PROBES[i].label);
+            if (!(probes & (1 << i)) || body.size + 2 + label_length > MAX_LENGTH) { continue; }
+
+            body.text[body.size++] = is_first ? '\n' : ',';
+            if (!is_first) { body.text[body.size++] = ' '; }
+            for (const char* c = LEAK_PROBES[i].label; *c != '\0'; c++) { body.text[body.size++] = *c; }
+            is_first = false;
+        }
+        body.text[body.size++] = CTRL_Z;
+        return body;
+    }
+}
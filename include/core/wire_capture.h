@@ -0,0 +1,37 @@
+#pragma once
+#include "config.h"
+
+// Modem UART traffic as the firmware sees it: every chunk written to or read from the SIM800L
+// with its micros() timestamp, kept in a fixed RAM ring (the oldest chunks are overwritten).
+// Off unless UART_CAPTURE_ENABLED. Dumped from the debug menu ('u') as "wire" lines,
+// the native runner's --decode-wire turns them into per command round trip tables
+
+
+namespace wire_capture {
+    enum class Direction : uint8_t {
+        Tx,     // ESP32 to the module
+        Rx
+    };
+
+    constexpr size_t CHUNK_SIZE = 26;   // Longer writes and reads take several chunks
+    constexpr size_t MAX_CHUNKS = 256;  // 8 kB, a first boot at 9600 baud and its SMS
+
+    struct Chunk {
+        uint32_t time_us;
+        Direction direction;
+        uint8_t size;
+        uint8_t data[CHUNK_SIZE];
+    };
+
+#if UART_CAPTURE_ENABLED
+    void record(Direction direction, const uint8_t* data, size_t size);
+#else
+    inline void record(Direction, const uint8_t*, size_t) {}
+#endif
+    size_t count();                                     // Chunks held, up to MAX_CHUNKS
+    const Chunk& at(size_t index);                      // Oldest first
+    uint32_t get_overwritten();
+    size_t format_chunk(const Chunk& chunk, char* buffer, size_t size);
+    void print();
+    void clear();
+}
@@ -0,0 +1,183 @@
+#pragma once
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Thin hardware abstraction layer. src/hal/hal_esp32.cpp implements it for the board,
+// src/hal/hal_native.cpp with host stand-ins for the [env:native] build
+
+#if defined(ARDUINO)
+    #include <esp_attr.h>   // IRAM_ATTR, RTC_DATA_ATTR, RTC_NOINIT_ATTR
+#else
+    #define IRAM_ATTR
+    #define RTC_DATA_ATTR __attribute__((section("rtc_data"), used))      // Kept across deep sleep by the runner
+    #define RTC_NOINIT_ATTR __attribute__((section("rtc_noinit"), used))  // Also across resets, not power off
+#endif
+
+
+namespace hal {
+    constexpr size_t FLASH_SECTOR_SIZE = 4096;  // Erase unit of the SPI flash
+    enum class Level : uint8_t {
+        Low,
+        High
+    };
+
+    enum class PinMode : uint8_t {
+        Input,
+        InputPulldown,
+        Output
+    };
+
+    enum class WakeupCause : uint8_t {
+        Undefined,  // Power on / reset
+        Ext0,
+        Ext1,
+        Timer,
+        Touchpad,
+        Ulp
+    };
+
+    struct Rgb {
+        uint8_t r;
+        uint8_t g;
+        uint8_t b;
+    };
+
+    struct HeapStats {
+        uint32_t allocations;   // Counted on native only
+        int32_t in_use_bytes;
+        int32_t peak_bytes;     // High-water mark
+    };
+
+    // Threshold watch run by the ULP coprocessor while the main cores deep sleep
+    struct UlpMonitor {
+        uint16_t threshold;     // Raw ADC reading counted when above
+        uint16_t count;         // Consecutive readings above the threshold that wake the cores
+        uint32_t interval_us;   // Between readings
+    };
+
+    // Shared with the ULP program through RTC memory
+    struct UlpState {
+        uint16_t run;           // Consecutive readings above the threshold so far
+        uint16_t last;          // Last reading
+        uint16_t samples;       // Readings taken (wraps)
+    };
+
+    // Clock
+    uint32_t millis();
+    uint32_t micros();
+    uint32_t boot_micros();     // Since reset, ROM and bootloader included where known
+    void delay(uint32_t ms);
+
+    // GPIO and ADC
+    void gpio_mode(uint8_t pin, PinMode mode);
+    void gpio_write(uint8_t pin, Level level);
+    void gpio_hold(uint8_t pin, bool is_held);     // Pad keeps its level, writes apply on release. RTC pads hold through deep sleep
+    Level gpio_read(uint8_t pin);
+    uint16_t adc_read(uint8_t pin);
+    void adc_scan(const uint8_t* pins, size_t num_of_pins, uint16_t* samples, size_t count, uint32_t interval_us); // count passes, pins interleaved
+
+    // Led (single WS2812B)
+    void led_begin(uint8_t pin);
+    void led_show(Rgb color);
+    void led_end();
+
+    // Persistent store (byte addressed, flash backed)
+    bool store_begin(size_t size);
+    uint8_t store_read(int address);
+    void store_write(int address, uint8_t value);
+    bool store_commit();
+    void store_end();
+
+    // USB serial console
+    void console_begin(uint32_t baud);
+    int console_available();
+    int console_read();
+    void console_printf(const char* format, ...) __attribute__((format(printf, 1, 2)));
+
+    // Heap
+    HeapStats heap_stats();
+
+    // Sleep and power
+    WakeupCause wakeup_cause();
+    [[noreturn]] void deep_sleep(uint64_t duration_us, uint8_t wakeup_pin);   // 0 us: no timer wake
+    [[noreturn]] void restart();
+    [[noreturn]] void halt();
+
+    // ULP leak watch, wakes with WakeupCause::Ulp. Runs until that wake (or power off)
+    bool ulp_monitor_start(uint8_t pin, const UlpMonitor& monitor);
+    UlpState ulp_monitor_state();
+
+    // Task pinned to a core (FreeRTOS). On native it runs deferred at join(), on its own
+    // virtual timeline starting at start(), so the overlap is deterministic
+    class Task {
+    public:
+        using Function = void (*)(void* argument);
+
+        bool start(const char* name, Function function, void* argument, uint8_t core, uint32_t stack_size);
+        void join();
+        bool is_started() const { return _is_started; }
+
+    private:
+        Function _function = nullptr;
+        void* _argument = nullptr;
+        void* _done = nullptr;          // ESP32: semaphore given when the function returns
+        uint64_t _start_us = 0;         // Native: virtual start time
+        bool _is_started = false;
+
+        static void entry(void* task);
+    };
+
+    // Raw flash partition (NOR: erase sets bits, program only clears them)
+    class Flash {
+    public:
+        size_t begin(const char* label);        // Partition size, 0 when missing
+        bool read(uint32_t offset, void* data, size_t size);
+        bool write(uint32_t offset, const void* data, size_t size);
+        bool erase_sector(uint32_t offset);
+        size_t size() const { return _size; }
+
+    private:
+        const void* _partition = nullptr;       // ESP32: esp_partition_t
+        uint32_t _base = 0;                     // Native: offset in the emulated flash
+        size_t _size = 0;
+    };
+
+    // UART stream
+    class Uart {
+    public:
+        explicit Uart(uint8_t port) : _port(port) {}
+
+        void begin(uint32_t baud, uint8_t rx_pin, uint8_t tx_pin);
+        void set_baud(uint32_t baud);   // Once pending TX is out
+        void end();
+        int available();
+        int read();
+        size_t read(uint8_t* buffer, size_t size);
+        size_t write(uint8_t byte);
+        size_t write(const uint8_t* data, size_t size);
+        void flush();
+
+        size_t print(const char* str) {
+            size_t size = 0;
+            while (str[size] != '\0') { size++; }
+            return write(reinterpret_cast<const uint8_t*>(str), size);
+        }
+
+        size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+            char buffer[256];
+            va_list args;
+            va_start(args, format);
+            int size = vsnprintf(buffer, sizeof(buffer), format, args);
+            va_end(args);
+
+            if (size <= 0) { return 0; }
+            if (static_cast<size_t>(size) >= sizeof(buffer)) { size = sizeof(buffer) - 1; }
+            return write(reinterpret_cast<const uint8_t*>(buffer), size);
+        }
+
+    private:
+        uint8_t _port;
+    };
+}
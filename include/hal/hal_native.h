@@ -0,0 +1,97 @@
+#pragma once
+#include "hal/hal.h"
+
+// Host side controls for the [env:native] stand-ins. Time is virtual: hal::delay()
+// advances the clock instantly, so a simulated boot runs in microseconds of real time
+
+
+namespace hal::native {
+    constexpr size_t STORE_SIZE = 4096;
+    constexpr uint8_t NUM_OF_PINS = 40;
+    constexpr size_t FLASH_SIZE = 0x18000;                  // Data partitions below, back to back
+    constexpr size_t NUM_OF_SECTORS = FLASH_SIZE / FLASH_SECTOR_SIZE;
+    constexpr size_t RTC_SIZE = 8192;                       // RTC slow memory
+
+    enum class ExitReason : uint8_t {
+        None,
+        Halt,
+        DeepSleep,
+        Restart,
+        Reset       // Watchdog, panic or brownout (set_reset_at)
+    };
+
+    // Bytes each way and their time on the wire since begin()
+    struct UartStats {
+        uint32_t tx_bytes;
+        uint32_t rx_bytes;
+        uint64_t wire_us;
+    };
+
+    // Raw data partitions, sizes as in partitions.csv
+    struct FlashPartition {
+        const char* label;
+        uint32_t offset;
+        size_t size;
+    };
+    constexpr FlashPartition FLASH_PARTITIONS[] = {
+        { "journal", 0x0000, 0x8000 },
+        { "events",  0x8000, 0x10000 }
+    };
+
+    // Survives simulated reboots, lives in memory shared with the boot runner
+    struct Persistent {
+        uint8_t store[STORE_SIZE];          // Flash backed store
+        uint32_t store_commits;
+        uint8_t flash[FLASH_SIZE];          // Raw data partitions
+        uint32_t flash_erases[NUM_OF_SECTORS];
+        uint32_t flash_writes;
+        WakeupCause wakeup_cause;           // For the next boot
+        ExitReason exit_reason;             // Of the last boot
+        uint64_t exit_time_us;              // Virtual time when the last boot ended
+        uint64_t sleep_duration_us;         // Requested deep sleep
+        Level gpio_level[NUM_OF_PINS];      // Output levels at exit
+        bool gpio_held[NUM_OF_PINS];        // Pads held through deep sleep (gpio_hold)
+        uint8_t rtc[RTC_SIZE];              // RTC_DATA_ATTR variables at deep sleep
+        uint8_t rtc_noinit[RTC_SIZE];       // RTC_NOINIT_ATTR variables at deep sleep, restart or reset
+        HeapStats heap;                     // Since reset_heap_stats(), at exit
+        bool is_ulp_running;                // ULP monitor armed, emulated by the runner while asleep
+        uint8_t ulp_pin;
+        UlpMonitor ulp_monitor;
+        UlpState ulp_state;
+    };
+
+    // Far end of a UART, e.g. the SIM800L stand-in
+    class UartPeer {
+    public:
+        virtual ~UartPeer() = default;
+        virtual void on_begin(uint32_t baud) { (void)baud; }
+        virtual void on_end() {}
+        virtual void on_receive(uint8_t byte, uint64_t time_us) = 0;
+        virtual void on_poll(uint64_t time_us) { (void)time_us; }  // Firmware checks the line, time based output (URCs) due by now
+    };
+
+    using GpioHook = void (*)(uint8_t pin, Level level, void* context);
+    using AdcSource = uint16_t (*)(uint8_t pin, uint64_t time_us, void* context);
+    using ExitHook = void (*)();
+
+    // Runner setup
+    Persistent& persistent();
+    void set_input(uint8_t pin, Level level);
+    void set_adc(uint8_t pin, uint16_t value);
+    void set_adc_source(AdcSource source, void* context);
+    void set_gpio_hook(GpioHook hook, void* context);
+    void attach_uart_peer(uint8_t port, UartPeer* peer);
+    void set_exit_hook(ExitHook hook);
+    void reset_heap_stats();
+    void restore_rtc_memory();         // Deep sleep wake: both RTC sections and the held pads
+    void restore_rtc_noinit();         // Reset: RTC_NOINIT_ATTR variables only, RTC_DATA_ATTR starts over
+    void set_reset_at(uint64_t time_us);   // Resets the boot when the virtual clock gets there
+    const FlashPartition* find_partition(const char* label);
+
+    // Peer side
+    uint64_t now_us();
+    void uart_inject(uint8_t port, const uint8_t* data, size_t size, uint64_t time_us);
+    uint32_t uart_baud(uint8_t port);
+    UartStats uart_stats(uint8_t port);
+    void uart_clear_rx(uint8_t port);
+}
@@ -0,0 +1,10 @@
+#pragma once
+#include "core/event_log.h"
+
+// Host side reader of the "events" partition: a raw dump from the board
+// (esptool.py read_flash 0x218000 0x10000 events.bin) or from the native runner
+
+
+namespace event_decoder {
+    int decode(const char* path, bool is_csv);
+}
@@ -0,0 +1,137 @@
+#pragma once
+#include "hal/hal_native.h"
+#include <string>
+#include <vector>
+
+// SIM800L stand-in for the [env:native] build. Answers the AT subset used by GsmModule, with
+// configurable latency, fragmented output, line noise and injected failures. Draws come from
+// a seeded generator, so a run is reproducible. Can also replay a recorded session instead
+// (load_transcript())
+
+
+class SimModem : public hal::native::UartPeer {
+public:
+    struct Profile {
+        uint32_t boot_ms = 3000;            // Power on until the first "AT" is answered
+        uint32_t response_ms = 20;          // Command to response
+        uint32_t sms_send_ms = 3000;        // Ctrl-Z to "+CMGS: <mr>"
+        int signal_quality = 20;            // +CSQ rssi (0-31, 99 = unknown)
+        uint32_t search_ms = 0;             // Boot until registered by the automatic network search
+        uint32_t select_ms = 1500;          // AT+COPS=4 on a known operator until registered
+        uint32_t select_ack_ms = 0;         // AT+COPS=4 answered this long after the +CREG URC
+        bool has_sim = true;                // false: AT+CCID fails, never registers
+        bool is_denied = false;             // Search ends with +CREG stat 3
+        bool has_coverage = true;           // false: searches without end (+CREG stat 2)
+        const char* operator_name = "Telia";
+        uint32_t fixed_baud = 0;            // AT+IPR rate kept by the module across power cuts, 0 auto-bauding
+        uint32_t jitter_ms = 0;             // Added to response_ms and sms_send_ms, uniform 0..jitter_ms
+        size_t fragment_bytes = 0;          // Output arrives in chunks of this many bytes, 0 in one piece
+        uint32_t fragment_gap_us = 0;       // Pause between chunks
+        float noise_rate = 0;               // Per output byte: replaced by a random one
+        float error_rate = 0;               // Per command: "ERROR" (+CMS ERROR for an SMS) instead of the answer
+        float drop_rate = 0;                // Per command: no answer at all
+        uint32_t seed = 1;                  // For the draws above
+    };
+
+    // Injected so far
+    struct Faults {
+        uint32_t commands;
+        uint32_t errors;
+        uint32_t drops;
+        uint32_t corrupted_bytes;
+    };
+
+    // Commands of the firmware against the transcript
+    struct ReplayStats {
+        uint32_t matched;
+        uint32_t skipped;               // Transcript commands the firmware did not send
+        uint32_t diverged;              // Not found further on, answered "ERROR"
+        uint32_t first_divergence;      // Transcript line the cursor was at, 0 none
+    };
+
+    // Carried to the next boot by the runner: the AT+IPR rate always, the rest while kept powered
+    struct Snapshot {
+        uint32_t fixed_baud;
+        bool is_powered;
+        bool is_echo_on;
+        bool is_creg_urc_on;
+        bool is_pdu_mode;
+        bool is_radio_on;               // AT+CFUN=1
+        bool is_registered;
+        uint8_t sleep_mode;             // AT+CSCLK
+        uint32_t message_reference;
+    };
+
+    SimModem(uint8_t port, uint8_t power_pin, const Profile& profile)
+        : _port(port), _power_pin(power_pin), _profile(profile), _random(profile.seed ? profile.seed : 1) {}
+
+    static bool preset(const char* name, Profile& profile);    // "ideal", "weak" or "flaky"
+    bool load_transcript(const char* path);
+    void reseed(uint32_t seed) { _random = seed ? seed : 1; }
+    void attach();
+    void on_receive(uint8_t byte, uint64_t time_us) override;
+    void on_poll(uint64_t time_us) override;
+    void on_end() override;
+
+    uint32_t get_sms_sent() const { return _sms_sent; }      // Messages, concatenated parts count once
+    uint64_t get_first_cmgs_us() const { return _first_cmgs_us; }
+    uint64_t get_last_ack_us() const { return _last_ack_us; }
+    void set_coverage(bool has_coverage) { _profile.has_coverage = has_coverage; }
+    const Faults& get_faults() const { return _faults; }
+    const ReplayStats& get_replay_stats() const { return _replay_stats; }
+    bool is_replaying() const { return !_transcript.empty(); }
+    Snapshot snapshot(uint64_t time_us) const;
+    void restore(const Snapshot& snapshot);
+
+private:
+    uint8_t _port;
+    uint8_t _power_pin;
+    Profile _profile;
+    bool _is_powered = false;
+    bool _is_echo_on = true;
+    bool _is_in_sms_body = false;
+    bool _is_pdu_mode = false;          // AT+CMGF=0
+    size_t _tpdu_length = 0;            // AT+CMGS=<length> in PDU mode
+    bool _is_creg_urc_on = false;
+    bool _is_creg_reported = false;
+    std::string _deferred;              // AT+COPS=4 answer, sent once due (after the +CREG URC)
+    uint64_t _deferred_us = UINT64_MAX;
+    bool _is_radio_on = true;
+    uint8_t _sleep_mode = 0;
+    bool _is_asleep = false;            // Sleep mode 2 and the UART quiet, the next line is lost
+    bool _is_line_lost = false;
+    uint64_t _last_rx_us = 0;
+    uint64_t _ready_us = 0;             // Boot done, answers from here on
+    uint64_t _registered_us = 0;
+    uint32_t _sms_sent = 0;
+    uint32_t _message_reference = 0;    // +CMGS: <mr>, one per part
+    uint64_t _first_cmgs_us = 0;
+    uint64_t _last_ack_us = 0;
+    std::string _line;
+    std::string _body;
+    uint32_t _random;                   // xorshift32 state
+    Faults _faults = {};
+
+    // Recorded session: "<ms> > <command>" sent by the ESP32, "<ms> < <line>" sent by the module
+    struct TranscriptLine {
+        uint32_t line;
+        uint64_t time_us;               // Since power on
+        bool is_from_modem;
+        std::string text;
+    };
+    std::vector<TranscriptLine> _transcript;
+    size_t _replay_next = 0;            // First entry not replayed yet
+    ReplayStats _replay_stats = {};
+
+    static void on_gpio(uint8_t pin, hal::Level level, void* context);
+    uint32_t next_random();
+    bool draw(float rate);
+    uint64_t response_time(uint64_t time_us, uint32_t delay_ms);
+    void handle_line(const std::string& command, uint64_t time_us);
+    void handle_command(const std::string& command, uint64_t time_us);
+    void replay_command(const std::string& command, uint64_t time_us);
+    void replay_until_command(uint64_t base_us, uint64_t recorded_us);
+    bool accept_body();   // false: PDU length mismatch
+    int registration_status(uint64_t time_us) const;
+    void reply(const std::string& text, uint64_t time_us);
+};
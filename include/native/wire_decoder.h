@@ -0,0 +1,12 @@
+#pragma once
+#include "core/wire_capture.h"
+
+// Host side reader of "wire" lines (wire_capture::print() over USB serial, or --wire-dump
+// from the native runner). Other lines are skipped, a whole console log can be given.
+// Pairs each command with the module's answer: time to the first byte back and to the
+// final result code (OK, ERROR, +CME/+CMS ERROR, the "> " prompt)
+
+
+namespace wire_decoder {
+    int decode(const char* path, bool is_csv);
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include "config.h"
+
+// Phase level latency tracing. Named, nestable spans recorded into a fixed buffer,
+// summarized in the diagnostic SMS and exported as Chrome trace JSON on the host
+
+
+namespace trace {
+    struct Event {
+        const char* name;
+        uint32_t start_us;
+        uint32_t end_us;        // 0 while open
+        uint8_t depth;
+    };
+
+    constexpr size_t MAX_EVENTS = 32;
+
+    int begin(const char* name);
+    void end(int index);
+    size_t get_events(const Event** events);
+    void format_summary(char* buffer, size_t size);
+    void export_chrome_json(FILE* file, int pid, int tid);
+    void print();
+
+    // Scoped span
+    class Span {
+    public:
+        explicit Span(const char* name) : _index(begin(name)) {}
+        ~Span() { end(_index); }
+        Span(const Span&) = delete;
+        Span& operator=(const Span&) = delete;
+
+    private:
+        int _index;
+    };
+}
@@ -11,5 +11,6 @@ namespace util {
     void debug_loop(Memory& memory, GsmModule& sms);
     void debug_input_gpio_digital(int gpio_num);
     void debug_input_gpio_analog(int gpio_num);
+    void debug_record_leak_trace();
     void debug_USB_serial(Memory& memory, GsmModule& sms);
 }
@@ -0,0 +1,254 @@
+
+#include "core/at_engine.h"
+#include "core/wire_capture.h"
+#include <string.h>
+
+// Unsolicited result codes the SIM800L may emit at any time
+static constexpr const char* URC_PREFIXES[] = {
+    "RDY",
+    "+CFUN:",
+    "+CPIN:",
+    "Call Ready",
+    "SMS Ready",
+    "+CREG:",
+    "+CMTI:",
+    "RING",
+    "NO CARRIER",
+    "UNDER-VOLTAGE",
+    "OVER-VOLTAGE",
+    "NORMAL POWER DOWN"
+};
+
+//
+// Public
+//
+
+AtResult AtEngine::command(const char* command, uint32_t timeout_ms) {
+    send(command);
+    return await_result(timeout_ms);
+}
+
+
+AtResult AtEngine::await_result(uint32_t timeout_ms) {
+    const uint32_t start_time = hal::millis();
+    AtResult result = AtResult::Timeout;
+    _is_pending = true;
+
+    // Returns as soon as a final result code arrives, the deadline is only an upper bound
+    while (true) {
+        if (check(result)) {
+            return result;
+        }
+        if (hal::millis() - start_time >= timeout_ms) {
+            abandon();
+            return AtResult::Timeout;
+        }
+        if (_abort_flag && _abort_flag->load()) {
+            abandon();
+            return AtResult::Aborted;
+        }
+        hal::delay(1); // Yield
+    }
+}
+
+
+void AtEngine::send(const char* command) {
+    // Dispatch leftovers (URCs, late replies) before the new command
+    poll();
+
+    // Copied, the caller's buffer may be gone before the answer arrives
+    strncpy(_command, command, LINE_SIZE - 1);
+    _command[LINE_SIZE - 1] = '\0';
+    _response_len = 0;
+    _response[0] = '\0';
+    _is_pending = true;
+
+    // Terminated by <CR> only, a trailing <LF> would leak into an SMS body after AT+CMGS
+    _stream.print(command);
+    _stream.print("\r");
+    wire_capture::record(wire_capture::Direction::Tx, reinterpret_cast<const uint8_t*>(command), strlen(command));
+    wire_capture::record(wire_capture::Direction::Tx, reinterpret_cast<const uint8_t*>("\r"), 1);
+}
+
+
+void AtEngine::write(const uint8_t* data, size_t size) {
+    // Raw bytes, e.g. an SMS body after the "> " prompt
+    _stream.write(data, size);
+    wire_capture::record(wire_capture::Direction::Tx, data, size);
+}
+
+
+bool AtEngine::check(AtResult& result) {
+    // Non-blocking, URCs are dispatched on the way
+    fill_rx();
+    if (!process_rx(result)) {
+        return false;
+    }
+    _is_pending = false;
+    _command[0] = '\0';
+    return true;
+}
+
+
+void AtEngine::abandon() {
+    // A late final result is dropped by the next poll()
+    _is_pending = false;
+    _command[0] = '\0';
+}
+
+
+void AtEngine::poll() {
+    AtResult ignored;
+    do {
+        fill_rx();
+        while (process_rx(ignored)) { } // Stale final results are dropped
+    } while (_stream.available() > 0);
+}
+
+
+void AtEngine::set_urc_handler(UrcHandler handler) {
+    _urc_handler = handler;
+}
+
+
+void AtEngine::set_abort_flag(const std::atomic<bool>* flag) {
+    // Checked while waiting, lets another core cancel a pending command
+    _abort_flag = flag;
+}
+
+
+std::string_view AtEngine::response() const {
+    return std::string_view(_response, _response_len);
+}
+
+//
+// Private
+//
+
+void AtEngine::fill_rx() {
+    uint8_t chunk[64];
+
+    // Bulk reads from the UART driver into the ring
+    while (_rx.space() > 0 && _stream.available() > 0) {
+        size_t size = _stream.read(chunk, (_rx.space() < sizeof(chunk)) ? _rx.space() : sizeof(chunk));
+        if (size == 0) { break; }
+        wire_capture::record(wire_capture::Direction::Rx, chunk, size);
+
+        for (size_t i = 0; i < size; i++) {
+            _rx.push(chunk[i]);
+        }
+    }
+}
+
+
+bool AtEngine::process_rx(AtResult& result) {
+    uint8_t byte = 0;
+
+    // Stops at a final result, the rest stays queued for the next call
+    while (_rx.pop(byte)) {
+        if (process_byte(static_cast<char>(byte), result)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+bool AtEngine::process_byte(char c, AtResult& result) {
+    // SMS text prompt "> " is never terminated by a newline
+    if (c == '>' && _line_len == 0) {
+        result = AtResult::Prompt;
+        return true;
+    }
+
+    // End of line
+    if (c == '\n') {
+        _line[_line_len] = '\0';
+        _line_len = 0;
+        return process_line(result);
+    }
+
+    // Store, drop overflow
+    if (c != '\r' && _line_len < LINE_SIZE - 1) {
+        _line[_line_len++] = c;
+    }
+    return false;
+}
+
+
+bool AtEngine::process_line(AtResult& result) {
+    const char* line = _line;
+
+    // Blank lines and command echo
+    if (line[0] == '\0' || is_command_echo(line)) {
+        return false;
+    }
+
+    // Final result codes
+    if (strcmp(line, "OK") == 0) {
+        result = AtResult::Ok;
+        return true;
+    }
+    if (strcmp(line, "ERROR") == 0 || strncmp(line, "+CME ERROR", 10) == 0) {
+        append_response(line);
+        result = AtResult::Error;
+        return true;
+    }
+    if (strncmp(line, "+CMS ERROR", 10) == 0) {
+        append_response(line);
+        result = AtResult::CmsError;
+        return true;
+    }
+
+    // Unsolicited, unless it is the answer to the pending command ("+CREG: .." for "AT+CREG?")
+    if (!is_command_response(line) && is_urc(line)) {
+        if (_urc_handler) { _urc_handler(line); }
+        return false;
+    }
+
+    // Intermediate response line
+    append_response(line);
+    return false;
+}
+
+
+bool AtEngine::is_command_echo(const char* line) const {
+    return _command[0] != '\0' && strcmp(line, _command) == 0;
+}
+
+
+bool AtEngine::is_command_response(const char* line) const {
+    // Extended commands only, "AT+CSQ" answers with "+CSQ: ..". Once answered, the same prefix is a URC again
+    if (!_is_pending || strncmp(_command, "AT+", 3) != 0) {
+        return false;
+    }
+    const char* name = _command + 2;
+    const size_t name_len = strcspn(name, "=?");
+
+    return strncmp(line, name, name_len) == 0 && line[name_len] == ':';
+}
+
+
+bool AtEngine::is_urc(const char* line) const {
+    for (const auto& prefix : URC_PREFIXES) {
+        if (strncmp(line, prefix, strlen(prefix)) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+void AtEngine::append_response(const char* line) {
+    const size_t line_len = strlen(line);
+
+    // Keep lines separated by '\n', truncate on overflow
+    if (_response_len + line_len + 2 > RESPONSE_SIZE) {
+        return;
+    }
+    if (_response_len > 0) {
+        _response[_response_len++] = '\n';
+    }
+    memcpy(_response + _response_len, line, line_len + 1);
+    _response_len += line_len;
+}
@@ -0,0 +1,201 @@
+
+#include "core/counter_journal.h"
+#include "core/crc32.h"
+#include <stddef.h>
+#include <string.h>
+
+//
+// Public
+//
+
+bool CounterJournal::mount(const char* label) {
+    _is_formatted = false;
+    _num_of_sectors = _flash.begin(label) / hal::FLASH_SECTOR_SIZE;
+    if (_num_of_sectors < 2) {
+        return false;
+    }
+
+    // Head: the sector whose first record (snapshot) is the newest
+    uint32_t newest = 0;
+    for (size_t sector = 0; sector < _num_of_sectors; sector++) {
+        Record first;
+        if (!_flash.read(sector * hal::FLASH_SECTOR_SIZE, &first, sizeof(first))) {
+            return false;
+        }
+        if (is_valid(first) && (!_is_formatted || first.sequence > newest)) {
+            newest = first.sequence;
+            _sector = sector;
+            _is_formatted = true;
+        }
+    }
+    if (!_is_formatted) {
+        return true;    // Empty partition, format() next
+    }
+
+    // Latest values from the head. A snapshot cut short by a power loss is
+    // completed from the previous sector, which is never erased before the head fills
+    uint32_t seen = 0;
+    uint32_t last_sequence = scan_sector(_sector, seen, false, &_slot);
+    if (seen != (1u << NUM_OF_COUNTERS) - 1) {
+        scan_sector((_sector + _num_of_sectors - 1) % _num_of_sectors, seen, true, nullptr);
+    }
+    _sequence = last_sequence + 1;
+    return true;
+}
+
+
+bool CounterJournal::is_formatted() const {
+    return _is_formatted;
+}
+
+
+bool CounterJournal::format(const uint32_t* values) {
+    memcpy(_values, values, sizeof(_values));
+    _sequence = 0;
+    _is_formatted = start_sector(0);
+    return _is_formatted;
+}
+
+
+uint32_t CounterJournal::get(int counter) const {
+    return (counter >= 0 && static_cast<size_t>(counter) < NUM_OF_COUNTERS) ? _values[counter] : 0;
+}
+
+
+bool CounterJournal::commit(const uint32_t* values) {
+    if (!_is_formatted) {
+        return false;
+    }
+
+    // Changed counters only
+    uint16_t changed[NUM_OF_COUNTERS];
+    size_t count = 0;
+    for (size_t counter = 0; counter < NUM_OF_COUNTERS; counter++) {
+        if (values[counter] != _values[counter]) {
+            _values[counter] = values[counter];
+            changed[count++] = counter;
+        }
+    }
+    if (count == 0) {
+        return true;    // Nothing to write
+    }
+
+    // Head full: compact into the next sector (snapshot includes the new values)
+    if (_slot + count > RECORDS_PER_SECTOR) {
+        return start_sector((_sector + 1) % _num_of_sectors);
+    }
+
+    // The whole batch in one program operation
+    Record records[NUM_OF_COUNTERS];
+    for (size_t i = 0; i < count; i++) {
+        records[i] = make_record(changed[i], _values[changed[i]]);
+    }
+    return write_records(records, count);
+}
+
+
+uint32_t CounterJournal::get_sequence() const {
+    return _sequence;
+}
+
+//
+// Private
+//
+
+CounterJournal::Record CounterJournal::make_record(uint16_t counter, uint32_t value) {
+    Record record;
+    record.sequence = _sequence++;
+    record.counter = counter;
+    record.reserved = 0xFFFF;
+    record.value = value;
+    record.crc = crc32(&record, offsetof(Record, crc));
+    return record;
+}
+
+
+bool CounterJournal::write_records(const Record* records, size_t count) {
+    const uint32_t offset = _sector * hal::FLASH_SECTOR_SIZE + _slot * sizeof(Record);
+    _slot += count;     // Torn records are skipped by mount(), the slots are used either way
+    return _flash.write(offset, records, count * sizeof(Record));
+}
+
+
+bool CounterJournal::start_sector(size_t sector) {
+    // Erased lazily, only when the ring comes back around. The old head stays intact
+    // until the snapshot below is complete
+    if (!is_sector_erased(sector) && !_flash.erase_sector(sector * hal::FLASH_SECTOR_SIZE)) {
+        return false;
+    }
+    _sector = sector;
+    _slot = 0;
+
+    Record snapshot[NUM_OF_COUNTERS];
+    for (size_t counter = 0; counter < NUM_OF_COUNTERS; counter++) {
+        snapshot[counter] = make_record(counter, _values[counter]);
+    }
+    return write_records(snapshot, NUM_OF_COUNTERS);
+}
+
+
+uint32_t CounterJournal::scan_sector(size_t sector, uint32_t& seen, bool only_unseen, size_t* free_slot) {
+    const uint32_t base = sector * hal::FLASH_SECTOR_SIZE;
+    const uint32_t seen_before = seen;
+    uint32_t last_sequence = 0;
+    Record records[SCAN_RECORDS];
+
+    if (free_slot) { *free_slot = RECORDS_PER_SECTOR; }
+
+    // Records are programmed in order, the first erased slot ends the sector
+    for (size_t slot = 0; slot < RECORDS_PER_SECTOR; slot += SCAN_RECORDS) {
+        if (!_flash.read(base + slot * sizeof(Record), records, sizeof(records))) {
+            break;
+        }
+        for (size_t i = 0; i < SCAN_RECORDS; i++) {
+            const Record& record = records[i];
+
+            if (is_erased(record)) {
+                if (free_slot) { *free_slot = slot + i; }
+                return last_sequence;
+            }
+            if (!is_valid(record) || record.counter >= NUM_OF_COUNTERS) {
+                continue;   // Torn write
+            }
+            if (!only_unseen || !(seen_before & (1u << record.counter))) {
+                _values[record.counter] = record.value;
+                seen |= 1u << record.counter;
+            }
+            last_sequence = record.sequence;
+        }
+    }
+    return last_sequence;
+}
+
+
+bool CounterJournal::is_sector_erased(size_t sector) {
+    const uint32_t base = sector * hal::FLASH_SECTOR_SIZE;
+    Record records[SCAN_RECORDS];
+
+    for (size_t slot = 0; slot < RECORDS_PER_SECTOR; slot += SCAN_RECORDS) {
+        if (!_flash.read(base + slot * sizeof(Record), records, sizeof(records))) {
+            return false;
+        }
+        for (size_t i = 0; i < SCAN_RECORDS; i++) {
+            if (!is_erased(records[i])) { return false; }
+        }
+    }
+    return true;
+}
+
+
+bool CounterJournal::is_valid(const Record& record) {
+    return record.crc == crc32(&record, offsetof(Record, crc));
+}
+
+
+bool CounterJournal::is_erased(const Record& record) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&record);
+    for (size_t i = 0; i < sizeof(Record); i++) {
+        if (bytes[i] != 0xFF) { return false; }
+    }
+    return true;
+}
@@ -0,0 +1,110 @@
+
+#include "core/energy.h"
+#include "core/memory.h"
+
+namespace energy {
+
+static constexpr size_t NUM_OF_PHASES = static_cast<size_t>(Phase::NumOfPhases);
+static constexpr float UAS_TO_MAH = 1.0f / 3600000000.0f;
+static constexpr float CURRENTS[NUM_OF_PHASES] = {
+    ENERGY_CPU_CURRENT,
+    ENERGY_MODEM_CURRENT,
+    ENERGY_MODEM_SEND_CURRENT,
+    ENERGY_LED_CURRENT,
+    ENERGY_ADC_CURRENT,
+    0                               // Sleep, given as a charge
+};
+
+static bool is_running[NUM_OF_PHASES] = {};
+static uint32_t start_us[NUM_OF_PHASES] = {};
+static uint64_t total_us[NUM_OF_PHASES] = {};
+static float sleep_charge = 0;      // mAh
+
+
+void start(Phase phase) {
+    const size_t index = static_cast<size_t>(phase);
+    if (is_running[index]) { return; }
+
+    start_us[index] = hal::micros();
+    is_running[index] = true;
+}
+
+
+void stop(Phase phase) {
+    const size_t index = static_cast<size_t>(phase);
+    if (!is_running[index]) { return; }
+
+    total_us[index] += hal::micros() - start_us[index];
+    is_running[index] = false;
+}
+
+
+void add_sleep(uint32_t duration_s, float current) {
+    sleep_charge += current * duration_s / 3600.0f;
+}
+
+
+float get_charge(Phase phase) {
+    // mAh this boot so far, running phases up to now
+    const size_t index = static_cast<size_t>(phase);
+    if (phase == Phase::Sleep) {
+        return sleep_charge;
+    }
+    if (phase == Phase::Awake) {
+        return CURRENTS[index] * hal::boot_micros() * UAS_TO_MAH;
+    }
+
+    uint64_t duration_us = total_us[index];
+    if (is_running[index]) {
+        duration_us += hal::micros() - start_us[index];
+    }
+    return CURRENTS[index] * duration_us * UAS_TO_MAH;
+}
+
+
+float get_boot_charge() {
+    float charge = 0;
+    for (size_t i = 0; i < NUM_OF_PHASES; i++) {
+        charge += get_charge(static_cast<Phase>(i));
+    }
+    return charge;
+}
+
+
+void commit(bool is_alert) {
+    // Whole boot in uAh, rounded once. The last alert boot is the unit of the life estimate
+    const int charge = static_cast<int>(get_boot_charge() * 1000 + 0.5f);
+    Memory::increment_eeprom_count(MemAddr::ChargeUsed, charge);
+    if (is_alert) {
+        Memory::reset_eeprom_count(MemAddr::AlertCharge);
+        Memory::increment_eeprom_count(MemAddr::AlertCharge, charge);
+    }
+}
+
+
+float read_battery_voltage() {
+    #if BATTERY_ADC_ENABLED
+        return hal::adc_read(PIN_BATTERY_ADC) * BATTERY_ADC_SCALE;
+    #else
+        return 0;
+    #endif
+}
+
+
+void format_summary(char* buffer, size_t size) {
+    // "12.3 mAh, ~410 alerts left, 3.95 V", this boot included
+    const float used = Memory::get_eeprom_count<uint32_t>(MemAddr::ChargeUsed) / 1000.0f + get_boot_charge();
+    const uint32_t alert = Memory::get_eeprom_count<uint32_t>(MemAddr::AlertCharge);
+    const float remaining = (used < BATTERY_CAPACITY) ? BATTERY_CAPACITY - used : 0;
+
+    char alerts[24] = "";
+    if (alert > 0) {
+        snprintf(alerts, sizeof(alerts), ", ~%u alerts left", static_cast<unsigned>(remaining * 1000 / alert));
+    }
+    char voltage[12] = "";
+    #if BATTERY_ADC_ENABLED
+        snprintf(voltage, sizeof(voltage), ", %.2f V", read_battery_voltage());
+    #endif
+    snprintf(buffer, size, "%.1f mAh%s%s", used, alerts, voltage);
+}
+} // Namespace energy
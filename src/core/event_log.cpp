@@ -0,0 +1,150 @@
+
+#include "core/event_log.h"
+#include "core/crc32.h"
+#include "trace.h"
+#include <string.h>
+
+namespace event_log {
+
+static constexpr size_t RECORDS_PER_SECTOR = hal::FLASH_SECTOR_SIZE / sizeof(Record);
+
+
+static Record make_empty() {
+    Record record;
+    memset(&record, 0, sizeof(record));
+    record.sms_type = static_cast<uint8_t>(SMSType::None);
+    record.csq = 99;
+    memset(record.reserved, 0xFF, sizeof(record.reserved));
+    for (Recipient& recipient : record.recipients) {
+        recipient.reference = 255;
+    }
+    return record;
+}
+
+
+static bool is_erased(const Record& record) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&record);
+    for (size_t i = 0; i < sizeof(Record); i++) {
+        if (bytes[i] != 0xFF) { return false; }
+    }
+    return true;
+}
+
+
+static bool is_sector_erased(hal::Flash& flash, size_t sector) {
+    Record records[16];
+
+    for (size_t slot = 0; slot < RECORDS_PER_SECTOR; slot += 16) {
+        if (!flash.read((sector * RECORDS_PER_SECTOR + slot) * sizeof(Record), records, sizeof(records))) {
+            return false;
+        }
+        for (const Record& record : records) {
+            if (!is_erased(record)) { return false; }
+        }
+    }
+    return true;
+}
+
+
+// Next free slot and its sequence. Head: the sector whose first record is the newest,
+// its records are appended in order so the first erased slot is found by bisection
+static bool find_next(hal::Flash& flash, size_t num_of_sectors, size_t& slot, uint32_t& sequence) {
+    bool is_found = false;
+    size_t head = 0;
+    uint32_t newest = 0;
+    Record record;
+
+    for (size_t sector = 0; sector < num_of_sectors; sector++) {
+        if (!flash.read(sector * hal::FLASH_SECTOR_SIZE, &record, sizeof(record))) {
+            return false;
+        }
+        if (is_valid(record) && (!is_found || record.sequence > newest)) {
+            newest = record.sequence;
+            head = sector;
+            is_found = true;
+        }
+    }
+    if (!is_found) {
+        slot = 0;
+        sequence = 0;
+        return true;
+    }
+
+    size_t low = 1;
+    size_t high = RECORDS_PER_SECTOR;
+    while (low < high) {
+        const size_t middle = (low + high) / 2;
+        if (!flash.read((head * RECORDS_PER_SECTOR + middle) * sizeof(Record), &record, sizeof(record))) {
+            return false;
+        }
+        if (is_erased(record)) { high = middle; } else { low = middle + 1; }
+    }
+
+    // Head full, the oldest sector is next
+    slot = (low < RECORDS_PER_SECTOR) ? head * RECORDS_PER_SECTOR + low : ((head + 1) % num_of_sectors) * RECORDS_PER_SECTOR;
+    sequence = newest + low;
+    return true;
+}
+
+
+static void sum_phases(Record& record) {
+    const trace::Event* events;
+    const size_t num_of_events = trace::get_events(&events);
+    const uint32_t now_us = hal::micros();
+
+    for (size_t i = 0; i < num_of_events; i++) {
+        for (size_t phase = 0; phase < NUM_OF_PHASES; phase++) {
+            if (strcmp(events[i].name, PHASE_NAMES[phase]) != 0) { continue; }
+
+            const uint32_t end_us = (events[i].end_us != 0) ? events[i].end_us : now_us;
+            const uint32_t total_ms = record.phase_ms[phase] + (end_us - events[i].start_us) / 1000;
+            record.phase_ms[phase] = (total_ms < UINT16_MAX) ? total_ms : UINT16_MAX;
+        }
+    }
+}
+
+//
+// Public
+//
+
+Record& current() {
+    static Record record = make_empty();
+    return record;
+}
+
+
+bool append() {
+    static hal::Flash flash;
+    const size_t num_of_sectors = flash.begin(EVENTS_PARTITION) / hal::FLASH_SECTOR_SIZE;
+    if (num_of_sectors == 0) {
+        return false;
+    }
+
+    size_t slot = 0;
+    uint32_t sequence = 0;
+    if (!find_next(flash, num_of_sectors, slot, sequence)) {
+        return false;
+    }
+
+    Record& record = current();
+    record.sequence = sequence;
+    record.version = VERSION;
+    record.wake_cause = static_cast<uint8_t>(hal::wakeup_cause());
+    record.awake_ms = hal::millis();
+    sum_phases(record);
+    record.crc = crc32(&record, offsetof(Record, crc));
+
+    // Entering a sector: erase what the ring left there (once per 64 boots)
+    const size_t sector = slot / RECORDS_PER_SECTOR;
+    if (slot % RECORDS_PER_SECTOR == 0 && !is_sector_erased(flash, sector) &&
+        !flash.erase_sector(sector * hal::FLASH_SECTOR_SIZE)) {
+        return false;
+    }
+    return flash.write(slot * sizeof(Record), &record, sizeof(record));
+}
+
+
+bool is_valid(const Record& record) {
+    return record.version >= 1 && record.version <= VERSION && record.crc == crc32(&record, offsetof(Record, crc));
+}
+} // Namespace event_log
@@ -1,18 +1,53 @@
 
 #include "core/gsm_module.h"
+#include "core/energy.h"
+#include "core/event_log.h"
+#include "core/outbox.h"
 #include "core/hardware.h"
+#include "trace.h"
 #include "utility.h"
+#include <charconv>
+#include <string.h>
+
+// AT+IPR rates tried in turn when the module does not answer at the cached one
+static constexpr uint32_t BAUD_RATES[] = { 115200, 57600, 38400, 19200, 9600 };
 
 //
 // Private members
 //
 
-bool GsmModule::_is_sim800l_on = false;
+ModemState GsmModule::_state = ModemState::Off;
+ModemFailure GsmModule::_failure = ModemFailure::None;
+std::atomic<bool> GsmModule::_is_cancelled(false);
+uint32_t GsmModule::_power_on_time = 0;
+uint32_t GsmModule::_baud_rate = MODEM_BAUD_RATE_DEFAULT;
+RTC_DATA_ATTR ModemStandby GsmModule::_standby = ModemStandby::Off;
+ModemStandby GsmModule::_resumed_from = ModemStandby::Off;
+uint32_t GsmModule::_state_start_time = 0;
+uint32_t GsmModule::_state_ms[static_cast<size_t>(ModemState::NumOfStates)] = {};
+int GsmModule::_state_span = -1;
+uint32_t GsmModule::_request_time = 0;
+uint32_t GsmModule::_next_poll_time = 0;
+uint32_t GsmModule::_poll_interval = REGISTRATION_POLL_MIN;
+int GsmModule::_registration = -1;
+bool GsmModule::_is_hint_sent = false;
+uint32_t GsmModule::_time_to_ready = 0;
 int GsmModule::_signal_strength = 0;
-String GsmModule::_boot_counter;
-String GsmModule::_total_sms_sent; 
-std::string GsmModule::_model_name = "undefined";
-std::string GsmModule::_network_operator = "undefined";
+char GsmModule::_boot_counter[32] = "";
+char GsmModule::_total_sms_sent[16] = ""; 
+char GsmModule::_model_name[16] = "undefined";
+char GsmModule::_network_operator[24] = "undefined";
+char GsmModule::_trace_summary[96] = "";
+char GsmModule::_energy_summary[48] = "";
+char GsmModule::_diagnostic_body[DIAGNOSTIC_MAX_LENGTH + 2] = "";
+size_t GsmModule::_diagnostic_length = 0;
+uint8_t GsmModule::_concat_reference = 0;
+uint8_t GsmModule::_alert_probes = 0;
+SmsReceipt GsmModule::_receipts[NUM_OF_PHONES_TO_SMS];
+network_cache::Entry GsmModule::_cache;
+bool GsmModule::_is_sim_known = false;
+bool GsmModule::_is_operator_current = false;
+bool GsmModule::_is_cache_dirty = false;
 
 //
 // Public
@@ -20,90 +55,252 @@ std::string GsmModule::_network_operator = "undefined";
 
 void GsmModule::begin(const SMSType sms_type) {
     hardware::set_led_color(sms_type);
-    digitalWrite(PIN_SIM800L_POWER_SWITCH, HIGH); 
 
-    // Establish UART connection
-    delay(8000);
-    GSM_serial.begin(9600, SERIAL_8N1, PIN_SIM800L_RX, PIN_SIM800L_TX);
+    // Power on and establish UART connection right away (only once per power cycle, or to retry)
+    if (_state == ModemState::Off || _state == ModemState::Failed) {
+        power_on();
+    }
+    run_until(ModemState::SimReady);
+}
 
-    // Handshake
-    if (!send_serial_and_verify("AT")) {
-        log("SIM800L device not found! \nConfigured serial pins: Gpio %i(TX) Gpio %i(RX)\n", 
-            PIN_SIM800L_TX, PIN_SIM800L_RX);
 
-    // Is SIM card installed?
-    } else if (!send_serial_and_verify("AT+CCID")) { 
-        log("Simcard not found! \n");
+void GsmModule::begin_async() {
+    #if MODEM_EARLY_START_ENABLED
+        if (_power_up_task.is_started()) { return; }
 
-    // Powered on!
-    } else {
-        log("SIM800L powered on! \n");
-        _is_sim800l_on = true;
-    }
+        // Read here on core 1, the store is not shared with the task: core 1 mounts the counters meanwhile
+        load_network_cache();
+
+        // Boot and register on core 0 while core 1 senses and does bookkeeping
+        _is_cancelled = false;
+        if (!_power_up_task.start("modem", power_up_task, this, MODEM_TASK_CORE, MODEM_TASK_STACK_SIZE)) {
+            log("Failed to start the SIM800L power up task\n");
+        }
+    #endif
 }
 
 
-void GsmModule::send_message(const SMSType sms_type) {
-    uint32_t connection_timeout = millis() + CONNECTION_TIMEOUT;
-    uint32_t current_time = 0;
-    bool all_sent = true;
+void GsmModule::cancel_async() {
+    if (!_power_up_task.is_started()) { return; }
 
-    // Initialize the SIM800L simcard module
-    begin(sms_type);
+    // Pending commands and waits return right away, then the caller powers down
+    _is_cancelled = true;
+    _power_up_task.join();
+    _is_cancelled = false;
+}
+
+
+SendResult GsmModule::send_message(const SMSType sms_type, uint8_t probes) {
+    outbox::push(sms_type, probes);
+    return send_pending();
+}
 
-    // Wait for connection 
-    while (!is_GSM_connected() && connection_timeout > current_time) {
-        delay(500);
-        log(".");
-        current_time = millis();
-        if (!_is_sim800l_on) { 
-            begin(); 
-        }
-    }
 
-    if (sms_type == SMSType::Diagnostic) { 
-        get_diagnostic_details();
+SendResult GsmModule::send_pending() {
+    if (outbox::size() == 0) { return SendResult::Delivered; }
+    const SMSType sms_type = outbox::at(outbox::size() - 1).sms_type;    // Newest, shown by the led
+    bool is_delivered = true;
+
+    // Initialize the SIM800L simcard module, unless already coming up on the other core
+    if (_power_up_task.is_started()) {
+        hardware::set_led_color(sms_type);
+        _power_up_task.join();
+    } else {
+        connect(sms_type);
     }
-    
-    // Send SMS (to multiple or single number)
-    for (const auto& phone_number : secret_phone_numbers) {
-        if (!send_sms(sms_type, phone_number)) { 
-            all_sent = false;
+
+    // Missing SIM card, denied or no network: nothing can go out, retried on a later wake
+    if (_state == ModemState::Registered) {
+        enter(ModemState::Sending);
+
+        // PDU or text mode, once per session
+        if (!send_serial_and_verify(SMS_PDU_MODE_ENABLED ? "AT+CMGF=0" : "AT+CMGF=1")) {
+            log("Failed to set SMS mode\n");
+        }
+
+        // Oldest message first, only to the recipients it has not reached yet. The next 
+        // AT+CMGS goes out as soon as the previous one is acknowledged
+        for (size_t index = 0; index < outbox::size(); index++) {
+            outbox::Message& message = outbox::at(index);
+            _alert_probes = message.probes;
+            if (message.sms_type == SMSType::Diagnostic) { 
+                get_diagnostic_details();
+            }
+
+            for (int i = 0; i < NUM_OF_PHONES_TO_SMS; i++) {
+                _receipts[i] = SmsReceipt();
+                _receipts[i].status = message.status[i];
+                if (outbox::is_final(message.status[i])) { continue; }
+
+                _receipts[i] = send_sms(message.sms_type, i);
+                message.status[i] = _receipts[i].status;
+                if (_receipts[i].status == SmsStatus::Sent) {
+                    Memory::increment_eeprom_count(MemAddr::SmsSent);    // Money/sms cost, also the quota
+                } else {
+                    is_delivered = false;
+                }
+                log("SMS %i: status %i, ref %i, %u ms\n", i + 1, static_cast<int>(_receipts[i].status), 
+                    _receipts[i].reference, _receipts[i].duration_ms);
+            }
+            record_event(message.sms_type);
         }
+
+        if (is_delivered) {
+            enter(ModemState::Done);
+        } else {
+            fail(ModemFailure::NotSent);
+        }
+    } else {
+        is_delivered = false;
+        for (size_t index = 0; index < outbox::size(); index++) {
+            outbox::Message& message = outbox::at(index);
+            for (SmsStatus& status : message.status) {
+                if (!outbox::is_final(status)) { status = SmsStatus::NoNetwork; }
+            }
+        }
+        for (SmsReceipt& receipt : _receipts) {
+            receipt.status = SmsStatus::NoNetwork;
+        }
+        record_event(sms_type);
     }
 
-    // SMS successful?
-    if (all_sent) {
-        Memory::increment_eeprom_count(MemAddr::SmsSent, NUM_OF_PHONES_TO_SMS);
+    outbox::end_session();
+    update_network_cache();
+
+    // Delivered, to be retried from a later wake, or given up (skipped). Failures are shown by the caller
+    if (is_delivered) {
         hardware::led_blink(4, Color::Green, 250);
-    } else {
-        hardware::error();
+        return SendResult::Delivered;
     }
+    if (outbox::size() > 0) {
+        log("%u message(s) pending, retry in %u s\n", static_cast<unsigned>(outbox::size()), outbox::get_retry_delay());
+        hardware::led_blink(2, Color::Red, 250);
+        return SendResult::Pending;
+    }
+    log("Message(s) given up\n");
+    return SendResult::GivenUp;
+}
+
+
+bool GsmModule::has_pending() {
+    return outbox::size() > 0;
 }
 
 
 void GsmModule::flush_buffers() {
+    cancel_async();
     GSM_serial.flush();
 }
 
 
 void GsmModule::flush_RX_buffer() {
-    // Wait and capture message in the RX buffer
-    delay(SERIAL_RESPONSE_TIMEOUT);
+    // Consume whatever is pending right now (URCs get dispatched), no waiting
+    _at.poll();
+}
 
-    // Empty the buffer, read into nothing
-    GSM_serial.setTimeout(10);
-    while (GSM_serial.available()) {
-        GSM_serial.readString();
-    }
+
+void GsmModule::standby(uint32_t duration_s) {
+    // Only a registered module is worth keeping powered
+    _standby = ModemStandby::Off;
+    if (_registration != 1 && _registration != 5) { return; }
+
+    const ModemStandby standby = choose_standby(duration_s);
+    if (standby == ModemStandby::Off) { return; }
+    if (standby == ModemStandby::Minimum && !send_serial_and_verify("AT+CFUN=0", AT_TIMEOUT_CFUN)) { return; }
+    if (!send_serial_and_verify("AT+CSCLK=2")) { return; }
+
+    log("SIM800L standby %i for %u s\n", static_cast<int>(standby), duration_s);
+    _standby = standby;
 }
 
 
 void GsmModule::power_off() {
-    if (_is_sim800l_on) {
-        log("SIM800L powering down!\n");
+    cancel_async();
+
+    if (_state != ModemState::Off) {
+        log("SIM800L powering down! Failure %i, ms per state: %u %u %u %u %u\n", static_cast<int>(_failure),
+            _state_ms[1], _state_ms[2], _state_ms[3], _state_ms[4], _state_ms[5]);
+    }
+
+    // Standby: the held pad keeps it powered while the cores deep sleep
+    if (_standby != ModemStandby::Off) {
+        hal::gpio_hold(PIN_SIM800L_POWER_SWITCH, true);
+    } else {
+        hal::gpio_write(PIN_SIM800L_POWER_SWITCH, hal::Level::Low);
+        hal::gpio_hold(PIN_SIM800L_POWER_SWITCH, false);
+    }
+    energy::stop(energy::Phase::ModemOn); // Standby is part of the sleep charge
+    enter(ModemState::Off);
+}
+
+
+void GsmModule::step() {
+    // At most one short AT exchange, waits are left to the caller
+    switch (_state) {
+        case ModemState::Booting:
+            step_booting();
+            break;
+        case ModemState::SimReady:
+            step_registering();
+            break;
+        default:
+            break; // Off, Registered and after: driven by begin() and send_message()
     }
-    digitalWrite(PIN_SIM800L_POWER_SWITCH, LOW);
+}
+
+
+ModemState GsmModule::get_state() {
+    return _state;
+}
+
+
+ModemFailure GsmModule::get_failure() {
+    return _failure;
+}
+
+
+uint32_t GsmModule::get_state_ms(ModemState state) {
+    return _state_ms[static_cast<size_t>(state)];
+}
+
+
+uint32_t GsmModule::get_time_to_ready() {
+    return _time_to_ready;
+}
+
+
+uint32_t GsmModule::get_baud_rate() {
+    return _baud_rate;
+}
+
+
+ModemStandby GsmModule::get_standby() {
+    return _standby;
+}
+
+
+float GsmModule::get_standby_current() {
+    switch (_standby) {
+        case ModemStandby::Sleep:   return MODEM_SLEEP_CURRENT;
+        case ModemStandby::Minimum: return MODEM_MINIMUM_CURRENT;
+        default:                    return 0;
+    }
+}
+
+
+ModemStandby GsmModule::choose_standby(uint32_t duration_s) {
+    // Charge until registered again after duration_s (mAs): kept registered, radio off or a cold start
+    const float sleep = MODEM_SLEEP_CURRENT * duration_s;
+    const float minimum = MODEM_MINIMUM_CURRENT * duration_s + MODEM_REATTACH_CHARGE;
+
+    if (sleep <= minimum && sleep <= MODEM_COLD_START_CHARGE) { return ModemStandby::Sleep; }
+    if (minimum <= MODEM_COLD_START_CHARGE) { return ModemStandby::Minimum; }
+    return ModemStandby::Off;
+}
+
+
+const SmsReceipt& GsmModule::get_receipt(int index) {
+    return _receipts[index];
 }
 
 
@@ -112,93 +309,496 @@ void GsmModule::power_off() {
 //
 
 
+void GsmModule::connect(const SMSType sms_type) {
+    if (_is_cancelled) { return; }
+    begin(sms_type);
+    run_until(ModemState::Registered);
+
+    // Signal once registered (diagnostic SMS, event log)
+    if (_state == ModemState::Registered) {
+        _signal_strength = get_GSM_signal_strength();
+    }
+}
+
+
+void GsmModule::power_up_task(void* module) {
+    static_cast<GsmModule*>(module)->connect(SMSType::None);
+}
+
+
+void GsmModule::load_network_cache() {
+    // Once per power cycle, for the UART rate at power on and the registration later on
+    static bool is_loaded = false;
+    if (!is_loaded) {
+        is_loaded = true;
+        network_cache::load(_cache);
+    }
+}
+
+
+void GsmModule::power_on() {
+    load_network_cache();   // Loaded by begin_async() already when powered up on core 0
+    _baud_rate = (_cache.baud_rate != 0) ? _cache.baud_rate : MODEM_BAUD_RATE_DEFAULT;
+
+    // Still powered after a standby: booted already, the first probe wakes it up
+    _resumed_from = _standby;
+    _standby = ModemStandby::Off;
+    hal::gpio_write(PIN_SIM800L_POWER_SWITCH, hal::Level::High); 
+    hal::gpio_hold(PIN_SIM800L_POWER_SWITCH, false);
+    energy::start(energy::Phase::ModemOn);
+    GSM_serial.begin(_baud_rate, PIN_SIM800L_RX, PIN_SIM800L_TX);
+    _at.set_urc_handler(handle_urc);
+    _power_on_time = hal::millis();
+    _failure = ModemFailure::None;
+    _registration = -1;
+    enter(ModemState::Booting);
+}
+
+
+void GsmModule::run_until(ModemState target) {
+    // Failed sorts after every other state, so does a target passed already
+    while (!_is_cancelled && _state < target) {
+        step();
+        if (_state < target) {
+            hal::delay(MODEM_STEP_INTERVAL);
+        }
+    }
+}
+
+
+void GsmModule::enter(ModemState state) {
+    const uint32_t now = hal::millis();
+    _state_ms[static_cast<size_t>(_state)] += now - _state_start_time;
+    _state_start_time = now;
+    _state = state;
+
+    // Trace phases: "modem" until the first answer, "net" until registered
+    trace::end(_state_span);
+    _state_span = -1;
+    if (state == ModemState::Booting) {
+        _state_span = trace::begin("modem");
+    } else if (state == ModemState::SimReady) {
+        _state_span = trace::begin("net");
+        _poll_interval = REGISTRATION_POLL_MIN;
+        _next_poll_time = now;
+    }
+}
+
+
+void GsmModule::fail(ModemFailure failure) {
+    _failure = failure;
+    enter(ModemState::Failed);
+}
+
+
+void GsmModule::step_booting() {
+    const uint32_t now = hal::millis();
+    AtResult result;
+
+    // "AT" probe in flight. Also syncs the SIM800L auto baud rate,
+    // boot URCs ("RDY", "Call Ready", "SMS Ready") are dispatched meanwhile
+    if (_at.is_pending()) {
+        if (_at.check(result) && result == AtResult::Ok) {
+            on_modem_ready();
+            return;
+        }
+        if (now - _request_time < MODEM_PROBE_INTERVAL) {
+            return;
+        }
+        _at.abandon(); // Lost while booting, probe again
+
+        // Still no answer: the module may have come up at another rate (swapped, cache lost)
+        if (now - _power_on_time >= MODEM_BAUD_RECOVERY_TIME) {
+            next_baud_rate();
+        }
+    }
+
+    if (now - _power_on_time >= MODEM_BOOT_TIMEOUT) {
+        log("SIM800L device not found! \nConfigured serial pins: Gpio %i(TX) Gpio %i(RX)\n", 
+            PIN_SIM800L_TX, PIN_SIM800L_RX);
+        fail(ModemFailure::NoModem);
+        return;
+    }
+    _at.send("AT");
+    _request_time = now;
+}
+
+
+void GsmModule::step_registering() {
+    const uint32_t now = hal::millis();
+    AtResult result;
+
+    // Registration hint in flight, completes once registered. +CREG URCs are dispatched meanwhile
+    if (_at.is_pending()) {
+        if (_at.check(result)) {
+            _is_operator_current = (result == AtResult::Ok);
+        } else if (now - _request_time >= AT_TIMEOUT_REGISTER_HINT) {
+            _at.abandon();
+        }
+        if (!_at.is_pending() && !_is_operator_current && _registration != 1 && _registration != 5) {
+            log("Cached operator %s not found, automatic registration\n", _cache.operator_name);
+            send_serial_and_verify("AT+COPS=0");
+        }
+    } else {
+        _at.poll();
+    }
+
+    // Registered, denied or out of time
+    if (_registration == 1 || _registration == 5) {
+        // The hint's OK/ERROR follows the +CREG URC. Awaited (up to its timeout above), once
+        // abandoned a late one would complete the next command and shift every answer after it
+        if (_at.is_pending()) { return; }
+        log("Registered in %u ms\n", now - _state_start_time);
+        enter(ModemState::Registered);
+        return;
+    }
+    if (_registration == 3) {
+        log("Network registration denied! \n");
+        fail(ModemFailure::Denied);
+        return;
+    }
+    if (now - _state_start_time >= CONNECTION_TIMEOUT) {
+        log("No network within %u ms! \n", CONNECTION_TIMEOUT);
+        fail(ModemFailure::NoNetwork);
+        return;
+    }
+    if (_at.is_pending()) {
+        return;
+    }
+
+    // Straight to the cached operator first, then queries in case a URC was missed:
+    // often at first, less often while nothing changes
+    if (!_is_hint_sent) {
+        _is_hint_sent = true;
+        if (send_registration_hint()) { 
+            _request_time = now;
+            return; 
+        }
+    }
+    if (static_cast<int32_t>(now - _next_poll_time) >= 0) {
+        const int previous = _registration;
+        query_registration();
+        _poll_interval = (_registration == previous) ? 
+            ((_poll_interval * 2 < REGISTRATION_POLL_MAX) ? _poll_interval * 2 : REGISTRATION_POLL_MAX) : REGISTRATION_POLL_MIN;
+        _next_poll_time = now + _poll_interval;
+    }
+}
+
+
+void GsmModule::on_modem_ready() {
+    std::string_view response;
+    _time_to_ready = hal::millis() - _power_on_time;
+    log("SIM800L powered on! Ready in %u ms\n", _time_to_ready);
+
+    send_serial_and_verify("ATE0");         // No echo, fewer bytes on the wire
+    negotiate_baud_rate();
+
+    // Out of standby: awake while the UART is quiet, radio back on
+    if (_resumed_from != ModemStandby::Off) {
+        send_serial_and_verify("AT+CSCLK=0");
+        if (_resumed_from == ModemStandby::Minimum) {
+            send_serial_and_verify("AT+CFUN=1", AT_TIMEOUT_CFUN);
+        }
+    }
+    send_serial_and_verify("AT+CREG=1");    // Registration changes as URCs
+
+    // Is SIM card installed?
+    if (!send_serial_and_verify("AT+CCID", response)) { 
+        log("Simcard not found! \n");
+        fail(ModemFailure::NoSim);
+        return;
+    }
+    check_sim(response);
+    enter(ModemState::SimReady);
+}
+
+
+void GsmModule::next_baud_rate() {
+    size_t index = 0;
+    while (index < sizeof(BAUD_RATES) / sizeof(BAUD_RATES[0]) && BAUD_RATES[index] != _baud_rate) { index++; }
+
+    // Unlisted rates start over from the top
+    index = (index + 1) % (sizeof(BAUD_RATES) / sizeof(BAUD_RATES[0]));
+    _baud_rate = BAUD_RATES[index];
+    GSM_serial.set_baud(_baud_rate);
+}
+
+
+void GsmModule::negotiate_baud_rate() {
+    // Fixed rate from now on, saved by the module itself. "OK" still comes at the old rate
+    if (_baud_rate != MODEM_BAUD_RATE) {
+        const uint32_t previous = _baud_rate;
+        char command[24];
+        snprintf(command, sizeof(command), "AT+IPR=%u", MODEM_BAUD_RATE);
+
+        if (send_serial_and_verify(command)) {
+            GSM_serial.set_baud(MODEM_BAUD_RATE);
+            _baud_rate = MODEM_BAUD_RATE;
+
+            if (!send_serial_and_verify("AT")) {
+                log("No answer at %u baud, back to %u\n", MODEM_BAUD_RATE, previous);
+                GSM_serial.set_baud(previous);
+                _baud_rate = previous;
+            }
+        }
+    }
+
+    // Answered at another rate than cached (recovered or negotiated), open at this one next time
+    if (_cache.baud_rate != _baud_rate) {
+        log("SIM800L at %u baud\n", _baud_rate);
+        _cache.baud_rate = _baud_rate;
+        _is_cache_dirty = true;
+    }
+}
+
+
+bool GsmModule::is_sim_ready() const {
+    return _state >= ModemState::SimReady && _state != ModemState::Failed;
+}
+
+
 bool GsmModule::send_sms_guard() {
     #if !SEND_SMS_ENABLED
         log("\nSEND_SMS_ENABLED = false\n");
         return false;
     #else
-        static uint8_t sms_counter = 0;
+        // Per boot, every queued message to every number at most. Then the SIM card quota
+        constexpr int max_per_boot = NUM_OF_PHONES_TO_SMS * outbox::CAPACITY;
+        static int sms_counter = 0;
 
-        if (sms_counter < NUM_OF_PHONES_TO_SMS) {
-            sms_counter++;
-            log("\nSending SMS %i/%i\n", sms_counter, NUM_OF_PHONES_TO_SMS);
-            return true;
-        } else {
-            log("Maximum number of SMS (%i/%i) already sent!\n", sms_counter, NUM_OF_PHONES_TO_SMS);
+        if (sms_counter >= max_per_boot) {
+            log("Maximum number of SMS (%i/%i) already sent!\n", sms_counter, max_per_boot);
             return false;
         }
+        if (Memory::get_eeprom_count<int>(MemAddr::SmsSent) > MAX_SMS_UNTILL_EMPTY_SIMCARD) {
+            log("SIM card quota (%i SMS) used up!\n", MAX_SMS_UNTILL_EMPTY_SIMCARD);
+            return false;
+        }
+        sms_counter++;
+        log("\nSending SMS %i/%i\n", sms_counter, max_per_boot);
+        return true;
     #endif
 }
 
 
-bool GsmModule::send_sms(const SMSType sms_type, const char* phone_number) {
-    if (!send_sms_guard()) { return false; }
+SmsReceipt GsmModule::send_sms(const SMSType sms_type, int recipient) {
+    SmsReceipt receipt;
+    if (!send_sms_guard()) { 
+        receipt.status = SmsStatus::Skipped;
+        return receipt; 
+    }
+    trace::Span span("sms");
+    const uint32_t start_time = hal::millis();
+    const char* phone_number = secret_phone_numbers[recipient];
+    char command[48];
+
+    #if SMS_PDU_MODE_ENABLED
+        // Alert PDUs of a single probe are ready made. Others and diagnostics are encoded here
+        if (sms_type == SMSType::Alert) {
+            static sms_pdu::Pdu encoded;
+            const sms_pdu::Pdu* pdu = &encoded;
+            if (_alert_probes != 0 && (_alert_probes & (_alert_probes - 1)) == 0) {
+                pdu = &sms_pdu::ALERTS[__builtin_ctz(_alert_probes)][recipient];
+            } else {
+                encoded = sms_pdu::encode_alert(phone_number, _alert_probes);
+            }
+            snprintf(command, sizeof(command), "AT+CMGS=%u", pdu->tpdu_length);
+            submit(command, pdu->hex, pdu->size, receipt);
+        } else {
+            static sms_pdu::Pdu pdu;
+            const char* body = _diagnostic_body;
+            size_t length = (sms_type == SMSType::Diagnostic) ? _diagnostic_length - 1 : 0; // Without Ctrl-Z
+            size_t parts = sms_pdu::count_parts(body, length);
+            if (parts > SMS_DIAGNOSTIC_MAX_PARTS) { parts = SMS_DIAGNOSTIC_MAX_PARTS; }
+
+            for (size_t part = 1; part <= parts; part++) {
+                const size_t count = (parts > 1) ? sms_pdu::fit_part(body, length, sms_pdu::MAX_PART_SEPTETS) : length;
+                pdu = sms_pdu::encode(phone_number, body, count, _concat_reference, part, parts);
+                snprintf(command, sizeof(command), "AT+CMGS=%u", pdu.tpdu_length);
+                if (submit(command, pdu.hex, pdu.size, receipt) != SmsStatus::Sent) { break; }
+
+                body += count;
+                length -= count;
+            }
+        }
+    #else
+        // Phone number, then the body (text mode is set once per session)
+        snprintf(command, sizeof(command), "AT+CMGS=\"%s\"", phone_number);
+        if (sms_type == SMSType::Alert) {
+            static sms_text::Body body;
+            body = sms_text::make_alert(_alert_probes);
+            submit(command, body.text, body.size, receipt);
+        } else if (sms_type == SMSType::Diagnostic) {
+            submit(command, _diagnostic_body, _diagnostic_length, receipt);
+        } else {
+            submit(command, &sms_text::CTRL_Z, 1, receipt);
+        }
+    #endif
+
+    if (receipt.status == SmsStatus::NoPrompt) {
+        log("No SMS prompt for %s\n", phone_number);
+    }
+    receipt.duration_ms = hal::millis() - start_time;
+    return receipt;
+}
+
+
+SmsStatus GsmModule::submit(const char* command, const char* body, size_t size, SmsReceipt& receipt) {
+    // Wait for the "> " prompt
+    if (_at.command(command, AT_TIMEOUT_SMS_PROMPT) != AtResult::Prompt) {
+        receipt.status = SmsStatus::NoPrompt;
+        return receipt.status;
+    }
+
+    // Body and Ctrl-Z in a single write. Send!
+    energy::start(energy::Phase::ModemSending);
+    _at.write(reinterpret_cast<const uint8_t*>(body), size);
+
+    // Acknowledge, "+CMGS: <mr>" followed by "OK"
+    AtResult result = _at.await_result(AT_TIMEOUT_SMS_SEND);
+    energy::stop(energy::Phase::ModemSending);
+    if (result == AtResult::Ok) {
+        receipt.status = SmsStatus::Sent;
+        std::string_view response = _at.response();
+        size_t index = response.find("+CMGS:");
+        if (index != std::string_view::npos) {
+            receipt.reference = string_to_int(response.substr(index + 7, response.find('\n', index) - index - 7));
+        }
+    } else if (result == AtResult::Timeout) {
+        receipt.status = SmsStatus::Timeout;
+    } else {
+        receipt.status = SmsStatus::Rejected;
+    }
+    return receipt.status;
+}
+
+
+void GsmModule::query_registration() {    
+    std::string_view response;
 
-    // SMS mode
-    GSM_serial.println("AT+CMGF=1");    
-    flush_RX_buffer(); // Needed! 4 hours debugging went into this :)))
+    // Expects "+CREG: <n>,<stat>"
+    if (send_serial_and_verify("AT+CREG?", response)) { 
+        const int status = parse_registration(response, false);
+        if (status >= 0) { _registration = status; }
+    }
+}
 
-    // Phone number
-    GSM_serial.print("AT+CMGS=\"");        
-    GSM_serial.print(phone_number);
-    GSM_serial.println("\"");
-    flush_RX_buffer();
 
-    // SMS: Alert
-    if (sms_type == SMSType::Alert) {
-        GSM_serial.printf("%s\r\n", SMS_ALERT_ROW_0);
-        GSM_serial.printf("%s\r\n", SMS_ALERT_ROW_1);
+void GsmModule::check_sim(std::string_view ccid_response) {
+    // Once per power cycle, begin() may run again while waiting for the network
+    static bool is_checked = false;
+    if (is_checked) { return; }
+    is_checked = true;
 
-    // SMS: Diagnostic
-    } else if (sms_type == SMSType::Diagnostic) {
-        GSM_serial.printf("%s\r\n",                 SMS_DIAGNOSTIC_ROW_0);
-        GSM_serial.printf("- Signal: %i%%\r\n",     _signal_strength);
-        GSM_serial.printf("- Network: %s\r\n",      _network_operator.c_str());
-        GSM_serial.printf("- Model: %s\r\n",        _model_name.c_str());
-        GSM_serial.printf("- Sms sent: %s\r\n",     _total_sms_sent.c_str());
-        GSM_serial.printf("- Boot count: %s\r\n",   _boot_counter.c_str());
+    // CCID digits, up to the line end
+    size_t start = ccid_response.find_first_of("0123456789");
+    if (start == std::string_view::npos) {
+        return;
+    }
+    std::string_view ccid = ccid_response.substr(start);
+    ccid = ccid.substr(0, ccid.find_first_not_of("0123456789ABCDEFabcdef"));
+
+    _is_sim_known = (ccid == _cache.ccid);
+
+    // Another SIM card, nothing cached applies but the module's own rate
+    if (!_is_sim_known) {
+        log("New SIM card, registration cache cleared\n");
+        const uint32_t baud_rate = _cache.baud_rate;
+        _cache = {};
+        _cache.baud_rate = baud_rate;
+        _cache.access_technology = 0xFF;
+        copy_view(_cache.ccid, sizeof(_cache.ccid), ccid);
+        _is_cache_dirty = true;
     }
+}
+
 
-    // Send!
-    GSM_serial.write(26);
-    flush_RX_buffer();
+bool GsmModule::send_registration_hint() {
+    if (!_is_sim_known || _cache.operator_name[0] == '\0' || _is_operator_current) {
+        return false;
+    }
 
-    // Acknowledge
-    std::string response = "";
-    get_serial_response(response, false, 7000);
-    return verify_serial_response(response);
+    // Manual selection of the last operator, automatic if it is not found (mode 4).
+    // Skips the full band search. Answered once registered or given up, not awaited here
+    char command[48];
+    if (_cache.access_technology != 0xFF) {
+        snprintf(command, sizeof(command), "AT+COPS=4,0,\"%s\",%u", _cache.operator_name, _cache.access_technology);
+    } else {
+        snprintf(command, sizeof(command), "AT+COPS=4,0,\"%s\"", _cache.operator_name);
+    }
+    _at.send(command);
+    return true;
 }
 
 
-bool GsmModule::is_GSM_connected() {    
-    return static_cast<bool>(get_GSM_signal_strength());
+void GsmModule::update_network_cache() {
+    // Learn the operator after the SMS went out, unless already confirmed this session
+    if (is_sim_ready() && !_is_operator_current) {
+        get_network_operator_name(_network_operator, sizeof(_network_operator));
+    }
+    if (!_is_cache_dirty) {
+        return;
+    }
+
+    if (!network_cache::save(_cache)) {
+        log("Failed to save the registration cache\n");
+        return;
+    }
+    _is_cache_dirty = false;
 }
 
 
 void GsmModule::get_diagnostic_details() {
-    // Grab info  
-    _signal_strength = get_GSM_signal_strength();
-    get_model_name(_model_name);
-    get_network_operator(_network_operator);
-    Memory::get_eeprom_counter_String(_boot_counter, MemAddr::BootCount);
-    Memory::get_eeprom_counter_String(_total_sms_sent, MemAddr::SmsSent);
+    // Grab info, the model from the cache while the SIM card is the same
+    if (_signal_strength == 0) {
+        _signal_strength = get_GSM_signal_strength();
+    }
+    if (_is_sim_known && _cache.model[0] != '\0') {
+        copy_view(_model_name, sizeof(_model_name), _cache.model);
+    } else {
+        get_model_name(_model_name, sizeof(_model_name));
+    }
+    get_network_operator(_network_operator, sizeof(_network_operator)); // Registered, answers right away
+    Memory::get_eeprom_counter_string(_boot_counter, sizeof(_boot_counter), MemAddr::BootCount);
+    Memory::get_eeprom_counter_string(_total_sms_sent, sizeof(_total_sms_sent), MemAddr::SmsSent);
+    Memory::reset_eeprom_count(MemAddr::BootCount);  // Counted since the last diagnostic
+    trace::format_summary(_trace_summary, sizeof(_trace_summary));
+    energy::format_summary(_energy_summary, sizeof(_energy_summary));
+    format_diagnostic_body();
 
     #if 0
-        log("\n%s\r\n",                 SMS_DIAGNOSTIC_ROW_0);
-        log("- Signal: %i%%\r\n",     _signal_strength);
-        log("- Network: %s\r\n",      _network_operator.c_str());
-        log("- Model: %s\r\n",        _model_name.c_str());
-        log("- Sms sent: %s\r\n",     _total_sms_sent.c_str());
-        log("- Boot count: %s\r\n",   _boot_counter.c_str());
+        log("\n%.*s\n", static_cast<int>(_diagnostic_length - 1), _diagnostic_body);
         STOP
     #endif
 }
 
 
+void GsmModule::format_diagnostic_body() {
+    // Formatted once for all recipients, cut at DIAGNOSTIC_MAX_LENGTH (one SMS in text mode)
+    int length = snprintf(_diagnostic_body, DIAGNOSTIC_MAX_LENGTH + 1,
+        "%s\n"
+        "- Signal: %i%%\n"
+        "- Network: %s\n"
+        "- Model: %s\n"
+        "- Sms sent: %s\n"
+        "- Boot count: %s\n"
+        "- Modem ms: ready %u, search %u\n"
+        "- Energy: %s\n"
+        "- Trace ms: %s",
+        SMS_DIAGNOSTIC_ROW_0, _signal_strength, _network_operator, _model_name, 
+        _total_sms_sent, _boot_counter, _time_to_ready, get_state_ms(ModemState::SimReady), _energy_summary, _trace_summary);
+
+    if (length < 0) { length = 0; }
+    _diagnostic_length = (static_cast<size_t>(length) < DIAGNOSTIC_MAX_LENGTH) ? length : DIAGNOSTIC_MAX_LENGTH;
+    _concat_reference = static_cast<uint8_t>(Memory::get_eeprom_count<uint32_t>(MemAddr::SmsSent));
+    _diagnostic_body[_diagnostic_length++] = sms_text::CTRL_Z; // Not null terminated
+}
+
+
 int GsmModule::get_GSM_signal_strength() {
-    std::string signal_strength = "";      
+    std::string_view signal_strength;
 
-    // Expects "AT+CSQ\n+CSQ: XX,X\n\nOK"
+    // Expects "+CSQ: XX,X"
     if (!send_serial_and_verify("AT+CSQ", signal_strength)) { 
         return 0; 
     }
@@ -207,136 +807,179 @@ int GsmModule::get_GSM_signal_strength() {
     size_t index = signal_strength.find("CSQ:");
 
     // Not found
-    if (index == std::string::npos) {
+    if (index == std::string_view::npos) {
         return 0;
     }
     
-    // Grab substring of numbers (CSQ: XX) 
-    signal_strength = signal_strength.substr(index + 5, 2); 
-
-    // Remove ',' if a single digit nummber (X,)
-    if (signal_strength[1] == ',') { 
-        signal_strength.pop_back(); 
-    }
+    // View of the numbers (CSQ: XX), up to the ','
+    signal_strength.remove_prefix(index + 5);
+    signal_strength = signal_strength.substr(0, signal_strength.find(','));
 
     // Max signal strength is 31. Convert to %
     int mapped_signal = string_to_int(signal_strength);
-    return map(mapped_signal, 0, 31, 0, 100);
+    event_log::current().csq = static_cast<uint8_t>(mapped_signal);
+    return mapped_signal * 100 / 31;
 }
 
 
-void GsmModule::get_model_name(std::string& model_name) {    
-    // Expects "ATI\n SIMXXX RXX.XX\n\nOK"
-    if (!send_serial_and_verify("ATI", model_name)) { 
+void GsmModule::get_model_name(char* model_name, size_t size) {    
+    std::string_view response;
+
+    // Expects "SIMXXX RXX.XX"
+    if (!send_serial_and_verify("ATI", response)) { 
         return; 
     }
 
     // Find index of "SIM"
-    size_t index = model_name.find("SIM");
+    size_t index = response.find("SIM");
 
     // Not found
-    if (index == std::string::npos) {
+    if (index == std::string_view::npos) {
         return;
     }
 
-    // Grab substring of model nr "SIMXXX RXX.XX" 
-    model_name = model_name.substr(index, 13); 
+    // Grab model nr "SIMXXX RXX.XX" 
+    copy_view(model_name, size, response.substr(index, 13)); 
+    if (strcmp(_cache.model, model_name) != 0) {
+        copy_view(_cache.model, sizeof(_cache.model), model_name);
+        _is_cache_dirty = true;
+    }
 }
 
 
-void GsmModule::get_network_operator(std::string& operator_name) {
-    uint32_t timeout = millis() + 10*1000;
+void GsmModule::get_network_operator(char* operator_name, size_t size) {
+    uint32_t timeout = hal::millis() + 10*1000;
     uint32_t current_time = 0;
 
     while (timeout > current_time) {
-        if (get_network_operator_name(operator_name)) {
+        if (get_network_operator_name(operator_name, size)) {
             break;
         } else {
-            delay(500);
+            hal::delay(500);
             log(".");
-            current_time = millis();
+            current_time = hal::millis();
         }
     }
 }
 
 
-bool GsmModule::get_network_operator_name(std::string& operator_name) {
-    // Expects "+COPS?\n+COPS: 0,0,"{operator name}"\n\nOK"
-    if (!send_serial_and_verify("AT+COPS?", operator_name)) { 
+bool GsmModule::get_network_operator_name(char* operator_name, size_t size) {
+    std::string_view response;
+
+    // Expects "+COPS: 0,0,"{operator name}""
+    if (!send_serial_and_verify("AT+COPS?", response)) { 
         return false; 
     }
     
     // Find start and end index of "{operator name}"
-    size_t start = operator_name.find("\"") + 1;
-    size_t end = operator_name.rfind("\"");
+    size_t start = response.find('"');
+    size_t end = response.rfind('"');
 
     // Not found
-    if (end == std::string::npos) {
+    if (start == std::string_view::npos || end == start) {
         return false;
     }
 
-    // Grab substring of {operator name} 
-    operator_name = operator_name.substr(start, end - start);
+    // Grab {operator name} 
+    copy_view(operator_name, size, response.substr(start + 1, end - start - 1));
+
+    // Access technology, when reported after the name ("+COPS: 0,0,"{operator name}",<AcT>")
+    uint8_t access_technology = 0xFF;
+    size_t separator = response.find(',', end);
+    if (separator != std::string_view::npos) {
+        access_technology = static_cast<uint8_t>(string_to_int(response.substr(separator + 1, 1)));
+    }
+
+    // Remembered for the next attach
+    if (strcmp(_cache.operator_name, operator_name) != 0 || _cache.access_technology != access_technology) {
+        copy_view(_cache.operator_name, sizeof(_cache.operator_name), operator_name);
+        _cache.access_technology = access_technology;
+        _is_cache_dirty = true;
+    }
+    _is_operator_current = true;
     return true;
 }
 
 
-void GsmModule::get_serial_response(std::string& response, bool print, uint extra_delay) {
-    // Wait and capture message in the RX buffer
-    delay(SERIAL_RESPONSE_TIMEOUT + extra_delay); 
+bool GsmModule::send_serial_and_verify(const char* command, uint32_t timeout_ms) {
+    return _at.command(command, timeout_ms) == AtResult::Ok;     // Completes on "OK"/"ERROR"
+}
 
-    // Early return
-    if (GSM_serial.available() <= 0) {
-        if (print) { log("Early return! \n"); }
-        return;
-    }
 
-    // Append incoming data
-    GSM_serial.setTimeout(10);
-    while (GSM_serial.available()) {
-        response.append( GSM_serial.readString().c_str() );  
-    }
+bool GsmModule::send_serial_and_verify(const char* command, std::string_view& response, uint32_t timeout_ms) {
+    bool is_ok = (_at.command(command, timeout_ms) == AtResult::Ok);
+    response = _at.response();                                  // View of the intermediate lines, echo stripped
+
+    return is_ok;
+}
 
-    // Debug
-    if (print) {
-        log("\n\n%s\n\n", response.c_str());
+
+void GsmModule::record_event(const SMSType sms_type) {
+    event_log::Record& record = event_log::current();
+    record.sms_type = static_cast<uint8_t>(sms_type);
+    record.modem_ready_ms = (_time_to_ready < UINT16_MAX) ? _time_to_ready : UINT16_MAX;
+    record.num_of_recipients = NUM_OF_PHONES_TO_SMS;
+    copy_view(record.operator_name, sizeof(record.operator_name), _cache.operator_name);
+
+    // First recipients only, the record has a fixed size
+    for (size_t i = 0; i < event_log::MAX_RECIPIENTS && i < NUM_OF_PHONES_TO_SMS; i++) {
+        event_log::Recipient& recipient = record.recipients[i];
+        recipient.status = static_cast<uint8_t>(_receipts[i].status);
+        recipient.reference = (_receipts[i].reference >= 0) ? _receipts[i].reference & 0xFF : 255;
+        recipient.duration_ms = (_receipts[i].duration_ms < UINT16_MAX) ? _receipts[i].duration_ms : UINT16_MAX;
     }
 }
 
 
-bool GsmModule::verify_serial_response(std::string& response) {
-    // Return true if "OK" found in response
-    return (response.rfind("OK") != std::string::npos) ? true : false;
+void GsmModule::handle_urc(const char* urc) {
+    log("URC: %s\n", urc);
+
+    // "+CREG: <stat>" (AT+CREG=1), the state machine acts on it at the next step
+    if (strncmp(urc, "+CREG:", 6) == 0) {
+        const int status = parse_registration(urc, true);
+        if (status >= 0) { _registration = status; }
+    }
 }
 
 
-bool GsmModule::send_serial_and_verify(const char* command, bool print, uint extra_delay) {
-    std::string response = "";
-    GSM_serial.println(command);                        // Send command      
-    get_serial_response(response, print, extra_delay);  // Grab returning response    
-               
-    return verify_serial_response(response);            // Look for "OK" in response     
+int GsmModule::parse_registration(std::string_view response, bool is_urc) {
+    // URC "+CREG: <stat>[,..]", query response "+CREG: <n>,<stat>[,..]"
+    size_t index = response.find("+CREG:");
+    if (index == std::string_view::npos) {
+        return -1;
+    }
+    response.remove_prefix(index + 6);
+    if (!is_urc) {
+        index = response.find(',');
+        if (index == std::string_view::npos) { return -1; }
+        response.remove_prefix(index + 1);
+    }
+
+    // Single digit 0..5
+    response.remove_prefix((response.size() > 0 && response[0] == ' ') ? 1 : 0);
+    return (response.size() > 0 && response[0] >= '0' && response[0] <= '5') ? response[0] - '0' : -1;
 }
 
 
-bool GsmModule::send_serial_and_verify(const char* command, std::string& response, bool print, uint extra_delay) {
-    GSM_serial.println(command);                        // Send command      
-    get_serial_response(response, print, extra_delay);  // Grab returning response    
-               
-    return verify_serial_response(response);            // Look for "OK" in response     
+void GsmModule::copy_view(char* buffer, size_t size, std::string_view view) {
+    size_t length = (view.size() < size - 1) ? view.size() : size - 1;
+    view.copy(buffer, length);
+    buffer[length] = '\0';
 }
 
 
-int GsmModule::string_to_int(std::string& response) {
-    try {
-        return std::stoi(response);
+int GsmModule::string_to_int(std::string_view text) {
+    int value = 0;
+    auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+    (void)end;
 
-    } catch (const std::invalid_argument&) {
+    if (error == std::errc::invalid_argument) {
         log("Error in string_to_int() -> Invalid argument\n");
         return 0;
 
-    } catch (const std::out_of_range&) {
+    } else if (error == std::errc::result_out_of_range) {
         log("Error in string_to_int() -> Out of range\n");
         return 0;
     }
+    return value;
 }
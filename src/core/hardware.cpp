@@ -1,30 +1,65 @@
 
 #include "core/hardware.h"
+#include "core/energy.h"
+#include "core/event_log.h"
+#include "core/leak_classifier.h"
+#include "core/outbox.h"
+#include "trace.h"
 #include "utility.h"
-#include <HardwareSerial.h>
 
 namespace hardware {
     
-static NeoPixelBus<NeoGrbFeature, NeoWs2812xMethod> pixel(1, PIN_LED); // Led
 static Memory* _memory_ptr;
 static GsmModule* _sms_ptr;
+static BootProfile _boot_profile;
+static uint8_t _leak_probes = 0;    // Wet in the last leak test, bit per LEAK_PROBES entry
+static bool _is_led_begun = false;
+
+// Survives deep sleep, lost when the power latch opens
+struct RtcState {
+    uint32_t magic;                 // Set by deepsleep()
+    uint32_t wakes;                 // Deep sleep wakes since power on
+    LeakDecision last_decision;
+    uint8_t realerts;               // Follow-up alerts sent for the current leak
+    bool is_realert_due;            // The next timer wake re-checks the sensor
+};
+static constexpr uint32_t RTC_STATE_MAGIC = 0x57414B45;   // "WAKE"
+static RTC_DATA_ATTR RtcState rtc_state;
+
+
+void shutdown_on_idle_wakeup() {
+    // Decided from RTC memory alone, before flash, led, serial or the SIM800L are touched.
+    // A timer wake has nothing left to do unless the last run was reset with counters unflushed,
+    // a leak is to be re-checked or a message to be retried
+    if (!woke_up_from_deepsleep() || rtc_state.magic != RTC_STATE_MAGIC || Memory::has_staged_counters() ||
+        rtc_state.is_realert_due || outbox::size() > 0) {
+        return;
+    }
+    rtc_state.wakes++;
+
+    hal::gpio_mode(PIN_CIRCUIT_POWER_SWITCH, hal::PinMode::Output);
+    hal::gpio_write(PIN_CIRCUIT_POWER_SWITCH, hal::Level::High);
+    hal::halt();
+}
 
 
 void IRAM_ATTR begin_hardware(Memory* memory, GsmModule* sms) {
+    trace::Span span("hw");
+
     // Whole circuit power switch
-    pinMode(PIN_CIRCUIT_POWER_SWITCH, OUTPUT);
-    digitalWrite(PIN_CIRCUIT_POWER_SWITCH, LOW);
+    hal::gpio_mode(PIN_CIRCUIT_POWER_SWITCH, hal::PinMode::Output);
+    hal::gpio_write(PIN_CIRCUIT_POWER_SWITCH, hal::Level::Low);
+    _boot_profile.latch_us = hal::boot_micros();
 
     // SIM800L power switch
-    pinMode(PIN_SIM800L_POWER_SWITCH, OUTPUT);
-    digitalWrite(PIN_SIM800L_POWER_SWITCH, LOW);
+    hal::gpio_mode(PIN_SIM800L_POWER_SWITCH, hal::PinMode::Output);
+    hal::gpio_write(PIN_SIM800L_POWER_SWITCH, hal::Level::Low);
 
-    pinMode(PIN_TEST_BUTTON, INPUT_PULLDOWN);
+    hal::gpio_mode(PIN_TEST_BUTTON, hal::PinMode::InputPulldown);
 
-    // Memory, Serial and Led
-    memory->begin(); 
+    // Serial only in development builds. The counter journal mounts and the led driver
+    // starts on first use, both after the leak decision
     begin_USB_serial();
-    pixel.Begin();    
 
     // Store pointers
     _memory_ptr = memory;
@@ -33,22 +68,23 @@ void IRAM_ATTR begin_hardware(Memory* memory, GsmModule* sms) {
     #if RESET_ALL
         _memory_ptr->reset_eeprom_count(MemAddr::BootCount); 
         _memory_ptr->reset_eeprom_count(MemAddr::SmsSent);
+        _memory_ptr->reset_eeprom_count(MemAddr::ChargeUsed);
+        _memory_ptr->reset_eeprom_count(MemAddr::AlertCharge);
+        _memory_ptr->flush();
         #if USB_SERIAL_ENABLED
             log("\n\n---- Reset all counters ----\n     Awaiting upload...\n");
         #else 
-            Serial.begin(115200);
-            while (!Serial) { }
-            Serial.printf("\n\n---- Reset all counters ----\n     Awaiting upload...\n");
+            hal::console_begin(115200);
+            hal::console_printf("\n\n---- Reset all counters ----\n     Awaiting upload...\n");
         #endif
-        while (1) { }
+        hal::halt();
     #endif
 }
 
 
 void begin_USB_serial() {
     #if USB_SERIAL_ENABLED 
-        Serial.begin(115200);
-        while (!Serial) { delay(1); }
+        hal::console_begin(115200);
 
         // Print
         constexpr const char* emote = "\xF0\x9F\x98\x8E\xF0\x9F\x98\x8E\xF0\x9F\x98\x8E";
@@ -57,12 +93,13 @@ void begin_USB_serial() {
         log("---- %i Phone number(s)\n", GsmModule::NUM_OF_PHONES_TO_SMS);
         log("---- SEND_SMS_ENABLED = %s\n", SEND_SMS_ENABLED ? "true" : "false");
         util::ESP32_print_wakeup_reason();
+        log("---- Last leak decision: %i, deepsleep wakes: %u\n", static_cast<int>(rtc_state.last_decision), rtc_state.wakes);
     #endif
 }
 
 
 bool is_test_button_pressed() {
-    bool pressed = digitalRead(PIN_TEST_BUTTON);
+    bool pressed = (hal::gpio_read(PIN_TEST_BUTTON) == hal::Level::High);
 
     if (pressed) { log("Test button pressed!\n"); }
     return pressed;
@@ -70,72 +107,198 @@ bool is_test_button_pressed() {
 
 
 bool is_water_leak_detected() {
-    pinMode(PIN_WATERLEAK_DETECT, INPUT_PULLDOWN);
-    constexpr uint8_t times = 25;
-    uint32_t value = 0;
-    
-    // Get average ADC reading
-    for (uint8_t i = 0; i < times; i++) {
-        value += analogRead(PIN_WATERLEAK_DETECT);
-        delay(1);
+    trace::Span span("leak");
+    constexpr size_t block_size = 4;
+    uint16_t block[block_size * NUM_OF_LEAK_PROBES];
+    LeakClassifier classifiers[NUM_OF_LEAK_PROBES];
+    uint8_t pins[NUM_OF_LEAK_PROBES];
+    uint8_t undecided[NUM_OF_LEAK_PROBES];  // Probe indices, in scan order
+    size_t num_of_undecided = NUM_OF_LEAK_PROBES;
+
+    for (size_t i = 0; i < NUM_OF_LEAK_PROBES; i++) {
+        LeakThresholds thresholds;
+        thresholds.wet_mean = LEAK_PROBES[i].wet_mean;
+        classifiers[i] = LeakClassifier(thresholds);
+        undecided[i] = i;
+        hal::gpio_mode(LEAK_PROBES[i].pin, hal::PinMode::InputPulldown);
     }
 
-    pinMode(PIN_WATERLEAK_DETECT, OUTPUT);
-    return (value / times > 5);
+    // Undecided probes sampled together in small blocks until each sequential test is
+    // confident (LEAK_MIN_SAMPLES to LEAK_MAX_SAMPLES). A decided probe drops out of the
+    // next pass. Blocks are paced like the passes within, every sample an interval apart
+    energy::start(energy::Phase::Adc);
+    uint32_t next_scan = hal::micros();
+    while (num_of_undecided > 0) {
+        for (size_t p = 0; p < num_of_undecided; p++) { pins[p] = LEAK_PROBES[undecided[p]].pin; }
+        while (static_cast<int32_t>(next_scan - hal::micros()) > 0) { }
+        hal::adc_scan(pins, num_of_undecided, block, block_size, LEAK_SAMPLE_INTERVAL);
+        next_scan = hal::micros() + LEAK_SAMPLE_INTERVAL;
+
+        size_t remaining = 0;
+        for (size_t p = 0; p < num_of_undecided; p++) {
+            LeakClassifier& classifier = classifiers[undecided[p]];
+            for (size_t i = 0; i < block_size && classifier.get_decision() == LeakDecision::Undecided; i++) {
+                classifier.add(block[i * num_of_undecided + p]);
+            }
+            if (classifier.get_decision() == LeakDecision::Undecided) { undecided[remaining++] = undecided[p]; }
+        }
+        num_of_undecided = remaining;
+    }
+    energy::stop(energy::Phase::Adc);
+
+    // Wet probes, and the one closest to wet for the event log
+    _leak_probes = 0;
+    size_t wettest = 0;
+    for (size_t i = 0; i < NUM_OF_LEAK_PROBES; i++) {
+        hal::gpio_mode(LEAK_PROBES[i].pin, hal::PinMode::Output);
+        if (classifiers[i].get_decision() == LeakDecision::Leak) { _leak_probes |= (1 << i); }
+        if (classifiers[i].get_mean() - LEAK_PROBES[i].wet_mean > classifiers[wettest].get_mean() - LEAK_PROBES[wettest].wet_mean) {
+            wettest = i;
+        }
+        log("Leak: %s %s after %u samples, mean %.1f\n", LEAK_PROBES[i].label, 
+            (_leak_probes & (1 << i)) ? "yes" : "no", classifiers[i].get_samples(), classifiers[i].get_mean());
+    }
+    const LeakDecision decision = (_leak_probes != 0) ? LeakDecision::Leak : LeakDecision::NoLeak;
+    _boot_profile.decision_us = hal::boot_micros();
+    rtc_state.last_decision = decision;
+
+    const LeakClassifier& classifier = classifiers[wettest];
+    event_log::Record& record = event_log::current();
+    record.leak_decision = static_cast<uint8_t>(decision);
+    record.leak_probes = _leak_probes;
+    record.adc_mean = static_cast<uint16_t>(classifier.get_mean() + 0.5f);
+    record.adc_max = classifier.get_max();
+    record.adc_samples = (classifier.get_samples() < UINT8_MAX) ? classifier.get_samples() : UINT8_MAX;
+    return (decision == LeakDecision::Leak);
+}
+
+
+uint8_t get_leak_probes() {
+    return _leak_probes;
+}
+
+
+bool start_leak_monitor() {
+    // Readings in a row above the dry/wet midpoint wake the cores early (WakeupCause::Ulp),
+    // the next boot then runs the full leak test
+    hal::UlpMonitor monitor;
+    monitor.threshold = static_cast<uint16_t>((LEAK_ADC_DRY + LEAK_PROBES[0].wet_mean) / 2);
+    monitor.count = ULP_LEAK_COUNT;
+    monitor.interval_us = ULP_LEAK_INTERVAL;
+
+    if (!hal::ulp_monitor_start(LEAK_PROBES[0].pin, monitor)) {
+        log("ULP leak monitor not started\n");
+        return false;
+    }
+    return true;
 }
 
 
 bool IRAM_ATTR woke_up_from_deepsleep() {
-    esp_sleep_wakeup_cause_t wakeup_reason;
-    wakeup_reason = esp_sleep_get_wakeup_cause();
+    return (hal::wakeup_cause() == hal::WakeupCause::Timer);
+}
+
+
+bool is_realert_due() {
+    return woke_up_from_deepsleep() && rtc_state.magic == RTC_STATE_MAGIC && rtc_state.is_realert_due;
+}
+
+
+bool is_retry_due() {
+    return woke_up_from_deepsleep() && outbox::size() > 0;
+}
 
-    return (wakeup_reason == ESP_SLEEP_WAKEUP_TIMER);
+
+uint32_t schedule_realert() {
+    // Called after each alert: the first of a leak, or a follow-up on a re-alert wake. One
+    // still undelivered (outbox) does not use up a follow-up
+    if (!is_realert_due()) {
+        rtc_state.realerts = 0;
+    } else if (outbox::size() == 0) {
+        rtc_state.realerts++;
+    }
+    rtc_state.is_realert_due = (rtc_state.realerts < REALERT_MAX);
+    if (!rtc_state.is_realert_due) {
+        return DEEPSLEEP_DURATION_LONG; // Then off as before, a leak still there latches power again
+    }
+
+    // Escalating intervals, the last one repeats
+    constexpr size_t num_of_intervals = sizeof(REALERT_INTERVALS) / sizeof(REALERT_INTERVALS[0]);
+    const size_t index = (rtc_state.realerts < num_of_intervals) ? rtc_state.realerts : num_of_intervals - 1;
+    log("Re-alert %u/%u check in %u s\n", rtc_state.realerts + 1, REALERT_MAX, REALERT_INTERVALS[index]);
+    return REALERT_INTERVALS[index];
+}
+
+
+void end_realert() {
+    // The leak cleared: later wakes (outbox retries) must not run the alert path again
+    rtc_state.is_realert_due = false;
+    rtc_state.realerts = 0;
 }
 
 
-void deepsleep(const uint32_t& sleep_duration_seconds) {
+void deepsleep(const uint32_t& duration_seconds) {
     // Skip the normal deepsleep while debugging
     #if USB_SERIAL_ENABLED && DEBUG_LOOP_ENABLED
         return;
     #endif
+
+    // Undelivered messages wake it earlier. 0 sleeps until the ULP monitor or the button wakes it
+    uint32_t sleep_duration_seconds = duration_seconds;
+    if (outbox::size() > 0 && (sleep_duration_seconds == 0 || outbox::get_retry_delay() < sleep_duration_seconds)) {
+        sleep_duration_seconds = outbox::get_retry_delay();
+    }
     
+    // Keep the SIM800L up through a re-alert or retry sleep when cheaper than a cold start
+    if ((rtc_state.is_realert_due || outbox::size() > 0) && _sms_ptr) {
+        _sms_ptr->standby(sleep_duration_seconds);
+    }
+    energy::add_sleep(sleep_duration_seconds, ENERGY_DEEPSLEEP_CURRENT + GsmModule::get_standby_current());
     peripherals_shutdown();
-    log("Deepsleep: %s\n", (sleep_duration_seconds < 60) ? "Short" : "Long");
-
-    // Set wakeup sources: Timer and TEST_BUTTON
-    esp_sleep_enable_timer_wakeup(sleep_duration_seconds * DEEPSLEEP_uS_TO_S_FACTOR);
-    esp_sleep_enable_ext0_wakeup(GPIO_NUM_13, 1);
-    static_assert(PIN_TEST_BUTTON == 13, "TEST_BUTTON GPIO changed!");
+    rtc_state.magic = RTC_STATE_MAGIC;
+    log("Deepsleep: %s\n", (sleep_duration_seconds == 0) ? "Until leak" : (sleep_duration_seconds < 60) ? "Short" : "Long");
 
     // ZzzzZZZzzZZZz
-    delay(1000); // Needed to prevent bootlooping
-    esp_deep_sleep_start();
+    hal::delay(1000); // Needed to prevent bootlooping
+
+    // Wakeup sources: Timer (unless 0) and TEST_BUTTON (must be an RTC gpio), the ULP when armed
+    hal::deep_sleep(sleep_duration_seconds * DEEPSLEEP_uS_TO_S_FACTOR, PIN_TEST_BUTTON);
     /*reboot*/
 }
 
 
 void peripherals_shutdown() {
+    trace::begin("off"); // Open until power is cut or deepsleep starts
+
     // GsmModule
     if (_sms_ptr) { 
         _sms_ptr->flush_buffers();
         _sms_ptr->power_off(); 
     }
-    // EEPROM memory
+    // Modelled drain of this boot (and the coming sleep) into the counters
+    energy::commit(event_log::current().sms_type == static_cast<uint8_t>(SMSType::Alert));
+
+    // EEPROM memory, then this boot's event record (one write each)
     if (_memory_ptr) { 
         _memory_ptr->end(); 
     }
+    event_log::append();
     // Led 
     led_end();
 }
 
 
 void system_shutdown() {
+    // Undelivered messages: deepsleep until the next retry instead
+    if (outbox::size() > 0) {
+        deepsleep(outbox::get_retry_delay());
+    }
     peripherals_shutdown();
 
     // Circuit power latch OFF
     log("Power OFF!\n");
-    digitalWrite(PIN_CIRCUIT_POWER_SWITCH, HIGH);  
-    while (1) { }
+    hal::gpio_write(PIN_CIRCUIT_POWER_SWITCH, hal::Level::High);  
+    hal::halt();
     /* OFF */
 }
 
@@ -151,51 +314,60 @@ void set_led_color(SMSType sms_type) {
         default:
             break;
     }
-    delay(1);
+    hal::delay(1);
 }
 
 
 void led_color(Color color) {
-    const int led_index = 0; // Only 1 led in total
-    
+    if (!_is_led_begun) {
+        hal::led_begin(PIN_LED);
+        _is_led_begun = true;
+    }
+
     // Set led color (color can be "Off")
-    RgbColor RGB = map_color_to_RGB(color);
-    pixel.SetPixelColor(led_index, RGB);
-    pixel.Show();
+    hal::led_show(map_color_to_RGB(color));
+    if (color == Color::Off) {
+        energy::stop(energy::Phase::Led);
+    } else {
+        energy::start(energy::Phase::Led);
+    }
 }
 
 
 void led_blink(size_t times, Color color, uint delay_ms) {
     for (size_t i = 0; i < times; i++) {
         led_color(color);       // On
-        delay(delay_ms);
+        hal::delay(delay_ms);
         led_color(Color::Off);  // Off
-        delay(delay_ms);
+        hal::delay(delay_ms);
     }
 }
 
 
 void led_end() {
+    if (!_is_led_begun) { return; } // Never lit this boot
+
     led_color(Color::Off);
-    delay(3); // Needed
-    pixel.~NeoPixelBus();
+    hal::delay(3); // Needed
+    hal::led_end();
+    _is_led_begun = false;
 }
 
 
-RgbColor map_color_to_RGB(Color color) {
+hal::Rgb map_color_to_RGB(Color color) {
     switch (color) {
         case Color::Orange:
-            return RgbColor(175, 35, 0);
+            return {175, 35, 0};
         case Color::Green:
-            return RgbColor(0, 155, 0);
+            return {0, 155, 0};
         case Color::Blue:
-            return RgbColor(0, 0, 175);
+            return {0, 0, 175};
         case Color::Red:
-            return RgbColor(155, 0, 0);
+            return {155, 0, 0};
         case Color::Off:
-            return RgbColor(0, 0, 0);
+            return {0, 0, 0};
         default:
-            return RgbColor(0, 0, 0);
+            return {0, 0, 0};
     }
 }
 
@@ -210,4 +382,9 @@ void error() {
         system_shutdown();
     #endif
 }
+
+
+const BootProfile& get_boot_profile() {
+    return _boot_profile;
+}
 }; // Namespace hardware
@@ -0,0 +1,68 @@
+
+#include "core/leak_classifier.h"
+
+//
+// Public
+//
+
+LeakClassifier::LeakClassifier(const LeakThresholds& thresholds) : _thresholds(thresholds) {
+    const float variance = thresholds.noise * thresholds.noise;
+
+    _midpoint = (thresholds.dry_mean + thresholds.wet_mean) / 2;
+    _scale = (thresholds.wet_mean - thresholds.dry_mean) / variance;
+    _upper = logf((1 - thresholds.miss_rate) / thresholds.false_alarm_rate);
+    _lower = logf(thresholds.miss_rate / (1 - thresholds.false_alarm_rate));
+    _sample_min = thresholds.dry_mean - thresholds.noise;
+    _sample_max = thresholds.wet_mean + thresholds.noise;
+}
+
+
+LeakDecision LeakClassifier::add(uint16_t sample) {
+    if (_decision != LeakDecision::Undecided) {
+        return _decision;
+    }
+    _sum += sample;
+    _samples++;
+    if (sample > _max) { _max = sample; }
+
+    // Gaussian readings with equal noise: the log likelihood ratio is linear in the sample
+    float value = sample;
+    if (value < _sample_min) { value = _sample_min; }
+    if (value > _sample_max) { value = _sample_max; }
+    _ratio += _scale * (value - _midpoint);
+
+    // A short burst of correlated readings is no evidence yet
+    if (_samples < _thresholds.min_samples && _samples < _thresholds.max_samples) {
+        return _decision;
+    }
+    if (_ratio >= _upper) {
+        _decision = LeakDecision::Leak;
+    } else if (_ratio <= _lower) {
+        _decision = LeakDecision::NoLeak;
+
+    // Out of samples, plain mean against the midpoint
+    } else if (_samples >= _thresholds.max_samples) {
+        _decision = (get_mean() > _midpoint) ? LeakDecision::Leak : LeakDecision::NoLeak;
+    }
+    return _decision;
+}
+
+
+LeakDecision LeakClassifier::get_decision() const {
+    return _decision;
+}
+
+
+uint16_t LeakClassifier::get_samples() const {
+    return _samples;
+}
+
+
+float LeakClassifier::get_mean() const {
+    return (_samples > 0) ? static_cast<float>(_sum) / _samples : 0;
+}
+
+
+uint16_t LeakClassifier::get_max() const {
+    return _max;
+}
@@ -1,79 +1,159 @@
 
 #include "core/memory.h"
+#include "trace.h"
+#include <string.h>
 
+CounterJournal Memory::_journal;
+uint32_t Memory::_counters[MemAddr::NumOfMemAddr];
 bool Memory::_has_eeprom_failed; 
+bool Memory::_is_mounted;
+
+// Unflushed counters, mirrored into RTC memory on every change. RTC_NOINIT_ATTR: not
+// reloaded on a reset (watchdog, panic, brownout the RTC domain rides out), unlike
+// RTC_DATA_ATTR. A power cut loses it, and with it only this run's unflushed changes.
+// Uninitialized after power on, only valid with the magic and on top of the journal
+// state it was staged against
+struct StagedCounters {
+    uint32_t magic;
+    uint32_t sequence;          // Journal sequence when staged
+    uint32_t values[MemAddr::NumOfMemAddr];
+};
+static constexpr uint32_t STAGED_MAGIC = 0x434E5452;   // "CNTR"
+static RTC_NOINIT_ATTR StagedCounters staged;
 
 
 void Memory::begin() {
-    constexpr int mem_size = static_cast<int>(MemAddr::NumOfMemAddr);
+    _is_mounted = true;
 
-    // Begin EEPROM
-    if (!EEPROM.begin(mem_size)) {
+    // Counter journal in its own flash partition
+    if (!_journal.mount(JOURNAL_PARTITION)) {
+        log("Counter journal partition \"%s\" not found! \n", JOURNAL_PARTITION);
         _has_eeprom_failed = true;
         return;
     }
 
-    // Init value on first boot
-    for (int address = 0; address < mem_size; address++) {
-        if (EEPROM.read(address) == 255) {
-            reset_eeprom_count(address);
+    // First boot on the journal, carry over the one byte EEPROM counters
+    if (!_journal.is_formatted()) {
+        uint32_t values[MemAddr::NumOfMemAddr] = {};
+        import_eeprom(values);
+
+        if (!_journal.format(values)) {
+            log("Failed to format the counter journal! \n");
+            _has_eeprom_failed = true;
+            return;
         }
     }
-}
 
+    for (int address = 0; address < MemAddr::NumOfMemAddr; address++) {
+        _counters[address] = _journal.get(address);
+    }
+    recover_staged();
+}
 
-void Memory::increment_eeprom_count(int address, int amount, bool bootup_delay) {
-    if (_has_eeprom_failed) { return; }
-    if (bootup_delay) { delay(1000); }
 
-    // Incremeent
-    uint8_t value = EEPROM.read(address);
-    EEPROM.write(address, value + amount);
+bool Memory::flush() {
+    mount_once();
+    if (_has_eeprom_failed) { return false; }
+    trace::Span span("commit");
 
-    // Failure
-    if (!EEPROM.commit()) {
+    // Every change of this boot in one journal write
+    if (!_journal.commit(_counters)) {
         log("Failed to write into EEPROM! \n");
         _has_eeprom_failed = true;
+        return false;
     }
+    staged.magic = 0;
+    return true;
 }
 
 
-void Memory::reset_eeprom_count(int address) {
+void Memory::increment_eeprom_count(int address, int amount) {
+    mount_once();
     if (_has_eeprom_failed) { return; }
 
-    // Reset memory bank
-    EEPROM.write(address, 0);
+    _counters[address] += amount;
+    stage();
+}
 
-    // Failure
-    if (!EEPROM.commit()) {
-        log("Failed to reset in EEPROM! \n");
-        _has_eeprom_failed = true;
-    }
+
+void Memory::reset_eeprom_count(int address) {
+    mount_once();
+    if (_has_eeprom_failed) { return; }
+
+    _counters[address] = 0;
+    stage();
 }
 
 
-void Memory::get_eeprom_counter_String(String& str, const int address) {
+void Memory::get_eeprom_counter_string(char* buffer, size_t size, const int address) {
     // Check if EEPROM has failed  
     if (get_has_eeprom_failed()) {
-        str = "EEPROM failed!";
+        snprintf(buffer, size, "EEPROM failed!");
 
     // BootCount
     } else if (address == MemAddr::BootCount) {
-        str = get_eeprom_count<String>(address) + " (resets to 0)";
-        reset_eeprom_count(address);
+        snprintf(buffer, size, "%i (resets to 0)", get_eeprom_count<int>(address));
 
     // SmsSent
     } else if (address == MemAddr::SmsSent) {
-        str = get_eeprom_count<String>(address) + "/" + MAX_SMS_UNTILL_EMPTY_SIMCARD;
+        snprintf(buffer, size, "%i/%i", get_eeprom_count<int>(address), MAX_SMS_UNTILL_EMPTY_SIMCARD);
     }
 }
 
 
+void Memory::mount_once() {
+    // Mounted on first use, keeps flash reads off the boot path until a counter is needed
+    if (!_is_mounted) {
+        begin();
+    }
+}
+
+
+void Memory::stage() {
+    staged.magic = STAGED_MAGIC;
+    staged.sequence = _journal.get_sequence();
+    memcpy(staged.values, _counters, sizeof(_counters));
+}
+
+
+void Memory::recover_staged() {
+    if (staged.magic != STAGED_MAGIC || staged.sequence != _journal.get_sequence()) {
+        return;
+    }
+
+    // The last run was reset before end(), its changes are still wanted
+    log("Recovering unflushed counters \n");
+    memcpy(_counters, staged.values, sizeof(_counters));
+    flush();
+}
+
+
+void Memory::import_eeprom(uint32_t* values) {
+    constexpr int mem_size = static_cast<int>(MemAddr::ChargeUsed);    // Counters of the one byte layout
+    if (!hal::store_begin(PERSISTENT_STORE_SIZE)) { 
+        return; 
+    }
+
+    // Erased cells (255) were never written
+    for (int address = 0; address < mem_size; address++) {
+        uint8_t value = hal::store_read(address);
+        values[address] = (value == 255) ? 0 : value;
+    }
+    hal::store_end();
+}
+
+
+bool Memory::has_staged_counters() {
+    return (staged.magic == STAGED_MAGIC);  // RTC memory only, no flash access
+}
+
+
 bool Memory::get_has_eeprom_failed() {
+    mount_once();
     return _has_eeprom_failed;
 }
 
 
 void Memory::end() {
-    EEPROM.end(); // void
+    flush();
 }
@@ -0,0 +1,50 @@
+
+#include "core/network_cache.h"
+#include "core/crc32.h"
+#include <string.h>
+
+namespace network_cache {
+
+static constexpr uint32_t MAGIC = 0x4E455443;  // "NETC"
+static_assert(NETWORK_CACHE_ADDRESS + sizeof(Entry) <= PERSISTENT_STORE_SIZE, "Network cache does not fit in the persistent store");
+
+
+bool load(Entry& entry) {
+    if (!hal::store_begin(PERSISTENT_STORE_SIZE)) {
+        return false;
+    }
+
+    uint8_t* bytes = reinterpret_cast<uint8_t*>(&entry);
+    for (size_t i = 0; i < sizeof(Entry); i++) {
+        bytes[i] = hal::store_read(NETWORK_CACHE_ADDRESS + i);
+    }
+    hal::store_end();
+
+    // Never written or torn
+    if (entry.magic != MAGIC || entry.crc != crc32(&entry, offsetof(Entry, crc))) {
+        memset(&entry, 0, sizeof(entry));
+        entry.access_technology = 0xFF;
+        return false;
+    }
+    return true;
+}
+
+
+bool save(const Entry& entry) {
+    if (!hal::store_begin(PERSISTENT_STORE_SIZE)) {
+        return false;
+    }
+
+    Entry sealed = entry;
+    sealed.magic = MAGIC;
+    sealed.crc = crc32(&sealed, offsetof(Entry, crc));
+
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&sealed);
+    for (size_t i = 0; i < sizeof(Entry); i++) {
+        hal::store_write(NETWORK_CACHE_ADDRESS + i, bytes[i]);
+    }
+    const bool is_committed = hal::store_commit();
+    hal::store_end();
+    return is_committed;
+}
+} // Namespace network_cache
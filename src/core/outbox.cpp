@@ -0,0 +1,102 @@
+
+#include "core/outbox.h"
+
+namespace outbox {
+
+struct State {
+    uint32_t magic;
+    uint8_t count;
+    Message messages[CAPACITY];
+};
+static constexpr uint32_t MAGIC = 0x4F555442;   // "OUTB"
+static RTC_NOINIT_ATTR State state;    // Uninitialized after power on, see is_valid()
+
+
+static bool is_valid() {
+    return state.magic == MAGIC && state.count <= CAPACITY;
+}
+
+
+static void remove(size_t index) {
+    for (size_t i = index + 1; i < state.count; i++) {
+        state.messages[i - 1] = state.messages[i];
+    }
+    state.count--;
+}
+
+
+void push(SMSType sms_type, uint8_t probes) {
+    if (!is_valid()) {
+        state.magic = MAGIC;
+        state.count = 0;
+    }
+
+    // A follow-up alert or a new diagnostic supersedes the undelivered one, its attempts carry
+    // over so a module that never gets through is given up on. Full: the oldest goes
+    uint8_t attempts = 0;
+    for (size_t i = 0; i < state.count; i++) {
+        if (state.messages[i].sms_type == sms_type) { 
+            attempts = state.messages[i].attempts;
+            remove(i); 
+            break; 
+        }
+    }
+    if (state.count == CAPACITY) { remove(0); }
+
+    Message& message = state.messages[state.count++];
+    message.sms_type = sms_type;
+    message.probes = probes;
+    message.attempts = attempts;
+    for (SmsStatus& status : message.status) {
+        status = SmsStatus::Pending;
+    }
+}
+
+
+size_t size() {
+    return is_valid() ? state.count : 0;
+}
+
+
+Message& at(size_t index) {
+    return state.messages[index];
+}
+
+
+bool is_final(SmsStatus status) {
+    return status == SmsStatus::Sent || status == SmsStatus::Skipped;
+}
+
+
+void end_session() {
+    for (size_t i = size(); i-- > 0; ) {
+        Message& message = state.messages[i];
+        message.attempts++;
+
+        bool is_delivered = true;
+        for (SmsStatus status : message.status) {
+            if (!is_final(status)) { is_delivered = false; }
+        }
+        if (!is_delivered && message.attempts < OUTBOX_MAX_ATTEMPTS) { continue; }
+
+        if (!is_delivered) {
+            log("Message %i given up after %u attempts\n", static_cast<int>(message.sms_type), message.attempts);
+        }
+        remove(i);
+    }
+}
+
+
+uint32_t get_retry_delay() {
+    // The soonest of the pending messages, intervals grow per attempt and the last one repeats
+    constexpr size_t num_of_intervals = sizeof(OUTBOX_RETRY_INTERVALS) / sizeof(OUTBOX_RETRY_INTERVALS[0]);
+    uint32_t delay = OUTBOX_RETRY_INTERVALS[num_of_intervals - 1];
+
+    for (size_t i = 0; i < size(); i++) {
+        const size_t attempts = state.messages[i].attempts;
+        const size_t index = (attempts < num_of_intervals) ? ((attempts > 0) ? attempts - 1 : 0) : num_of_intervals - 1;
+        if (OUTBOX_RETRY_INTERVALS[index] < delay) { delay = OUTBOX_RETRY_INTERVALS[index]; }
+    }
+    return delay;
+}
+} // Namespace outbox
@@ -0,0 +1,92 @@
+
+#include "core/wire_capture.h"
+#include <string.h>
+
+namespace wire_capture {
+
+// Written by the task that drives the modem only, no locking
+#if UART_CAPTURE_ENABLED
+static Chunk chunks[MAX_CHUNKS];
+#else
+static Chunk chunks[1];
+#endif
+static uint32_t num_of_chunks = 0;     // Ever recorded, the ring index wraps
+
+
+#if UART_CAPTURE_ENABLED
+void record(Direction direction, const uint8_t* data, size_t size) {
+    const uint32_t time_us = hal::micros();
+
+    while (size > 0) {
+        Chunk& chunk = chunks[num_of_chunks++ % MAX_CHUNKS];
+        chunk.time_us = time_us;
+        chunk.direction = direction;
+        chunk.size = static_cast<uint8_t>((size < CHUNK_SIZE) ? size : CHUNK_SIZE);
+        memcpy(chunk.data, data, chunk.size);
+
+        data += chunk.size;
+        size -= chunk.size;
+    }
+}
+#endif
+
+
+size_t count() {
+    #if UART_CAPTURE_ENABLED
+        return (num_of_chunks < MAX_CHUNKS) ? num_of_chunks : MAX_CHUNKS;
+    #else
+        return 0;
+    #endif
+}
+
+
+const Chunk& at(size_t index) {
+    #if UART_CAPTURE_ENABLED
+        const uint32_t oldest = (num_of_chunks < MAX_CHUNKS) ? 0 : num_of_chunks - MAX_CHUNKS;
+        return chunks[(oldest + index) % MAX_CHUNKS];
+    #else
+        (void)index;
+        return chunks[0];
+    #endif
+}
+
+
+uint32_t get_overwritten() {
+    return num_of_chunks - count();
+}
+
+
+// "wire 1204518 tx AT+CSQ\r", control bytes and '\' escaped
+size_t format_chunk(const Chunk& chunk, char* buffer, size_t size) {
+    int written = snprintf(buffer, size, "wire %u %s ", chunk.time_us, (chunk.direction == Direction::Tx) ? "tx" : "rx");
+    if (written < 0 || static_cast<size_t>(written) >= size) { return 0; }
+    size_t length = written;
+
+    for (size_t i = 0; i < chunk.size && length + 5 < size; i++) {
+        const uint8_t c = chunk.data[i];
+        if (c == '\r')                      { length += snprintf(buffer + length, size - length, "\\r"); }
+        else if (c == '\n')                 { length += snprintf(buffer + length, size - length, "\\n"); }
+        else if (c == '\\')                 { length += snprintf(buffer + length, size - length, "\\\\"); }
+        else if (c < ' ' || c > '~')        { length += snprintf(buffer + length, size - length, "\\x%02X", c); }
+        else                                { buffer[length++] = static_cast<char>(c); }
+    }
+    buffer[length] = '\0';
+    return length;
+}
+
+
+void print() {
+    char line[32 + 4 * CHUNK_SIZE];
+
+    for (size_t i = 0; i < count(); i++) {
+        format_chunk(at(i), line, sizeof(line));
+        log("%s\n", line);
+    }
+    log("wire: %u chunks, %u overwritten\n", static_cast<unsigned>(count()), get_overwritten());
+}
+
+
+void clear() {
+    num_of_chunks = 0;
+}
+} // Namespace wire_capture
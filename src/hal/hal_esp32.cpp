@@ -0,0 +1,445 @@
+
+#include "hal/hal.h"
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <HardwareSerial.h>
+#include <NeoPixelBus.h>
+#include <driver/adc.h>
+#include <driver/rtc_io.h>
+#include <esp_partition.h>
+#include <esp_system.h>
+#include <esp32/clk.h>
+#include <esp32/ulp.h>
+#include <new>
+#include <soc/sens_reg.h>
+
+namespace hal {
+
+using PixelBus = NeoPixelBus<NeoGrbFeature, NeoWs2812xMethod>;
+
+// Constructed in led_begin() and destroyed in led_end(), once each: the destructor frees
+// the RMT channel and the pin, a static bus would only release them at exit
+alignas(PixelBus) static uint8_t pixel_storage[sizeof(PixelBus)];
+static PixelBus* pixel = nullptr;
+
+
+// ULP program data (RTC slow memory words, low 16 bits), the program follows
+enum UlpSlot : uint32_t {
+    ULP_THRESHOLD,
+    ULP_COUNT,
+    ULP_RUN,
+    ULP_LAST,
+    ULP_SAMPLES,
+    ULP_PROGRAM
+};
+
+
+static HardwareSerial& port_serial(uint8_t port) {
+    return (port == 1) ? Serial1 : Serial2;
+}
+
+//
+// Clock
+//
+
+uint32_t millis() {
+    return ::millis();
+}
+
+
+uint32_t micros() {
+    return ::micros();
+}
+
+
+uint32_t boot_micros() {
+    // The RTC timer starts at power on, micros() only once the app is loaded
+    if (esp_reset_reason() == ESP_RST_POWERON) {
+        return static_cast<uint32_t>(esp_clk_rtc_time());
+    }
+    return ::micros();
+}
+
+
+void delay(uint32_t ms) {
+    ::delay(ms);
+}
+
+//
+// GPIO and ADC
+//
+
+void gpio_mode(uint8_t pin, PinMode mode) {
+    switch (mode) {
+        case PinMode::Input:            pinMode(pin, INPUT);            break;
+        case PinMode::InputPulldown:    pinMode(pin, INPUT_PULLDOWN);   break;
+        case PinMode::Output:           pinMode(pin, OUTPUT);           break;
+    }
+}
+
+
+void gpio_write(uint8_t pin, Level level) {
+    digitalWrite(pin, (level == Level::High) ? HIGH : LOW);
+}
+
+
+void gpio_hold(uint8_t pin, bool is_held) {
+    if (is_held) {
+        gpio_hold_en(static_cast<gpio_num_t>(pin));
+    } else {
+        gpio_hold_dis(static_cast<gpio_num_t>(pin));
+    }
+}
+
+
+Level gpio_read(uint8_t pin) {
+    return digitalRead(pin) ? Level::High : Level::Low;
+}
+
+
+uint16_t adc_read(uint8_t pin) {
+    return analogRead(pin);
+}
+
+
+void adc_scan(const uint8_t* pins, size_t num_of_pins, uint16_t* samples, size_t count, uint32_t interval_us) {
+    // Paced passes of one-shot conversions, the pins back to back. The continuous (DMA)
+    // driver only reaches ADC1, the first leak leg (gpio 4) is on ADC2
+    uint32_t next_time = ::micros();
+
+    for (size_t i = 0; i < count; i++) {
+        if (i > 0) {
+            next_time += interval_us;
+            while (static_cast<int32_t>(next_time - ::micros()) > 0) { }
+        }
+        for (size_t p = 0; p < num_of_pins; p++) {
+            samples[i * num_of_pins + p] = analogRead(pins[p]);
+        }
+    }
+}
+
+//
+// Led
+//
+
+void led_begin(uint8_t pin) {
+    led_end();
+    pixel = new (pixel_storage) PixelBus(1, pin);
+    pixel->Begin();
+}
+
+
+void led_show(Rgb color) {
+    if (!pixel) { return; }
+
+    const int led_index = 0; // Only 1 led in total
+    pixel->SetPixelColor(led_index, RgbColor(color.r, color.g, color.b));
+    pixel->Show();
+}
+
+
+void led_end() {
+    if (!pixel) { return; }
+
+    pixel->~PixelBus();
+    pixel = nullptr;
+}
+
+//
+// Persistent store
+//
+
+bool store_begin(size_t size) {
+    return EEPROM.begin(size);
+}
+
+
+uint8_t store_read(int address) {
+    return EEPROM.read(address);
+}
+
+
+void store_write(int address, uint8_t value) {
+    EEPROM.write(address, value);
+}
+
+
+bool store_commit() {
+    return EEPROM.commit();
+}
+
+
+void store_end() {
+    EEPROM.end();
+}
+
+//
+// Raw flash partition
+//
+
+static const esp_partition_t* as_partition(const void* partition) {
+    return static_cast<const esp_partition_t*>(partition);
+}
+
+
+size_t Flash::begin(const char* label) {
+    const esp_partition_t* partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+    _partition = partition;
+    _size = partition ? partition->size : 0;
+    return _size;
+}
+
+
+bool Flash::read(uint32_t offset, void* data, size_t size) {
+    return _partition && esp_partition_read(as_partition(_partition), offset, data, size) == ESP_OK;
+}
+
+
+bool Flash::write(uint32_t offset, const void* data, size_t size) {
+    return _partition && esp_partition_write(as_partition(_partition), offset, data, size) == ESP_OK;
+}
+
+
+bool Flash::erase_sector(uint32_t offset) {
+    return _partition && esp_partition_erase_range(as_partition(_partition), offset, FLASH_SECTOR_SIZE) == ESP_OK;
+}
+
+//
+// USB serial console
+//
+
+void console_begin(uint32_t baud) {
+    Serial.begin(baud);
+    while (!Serial) { ::delay(1); }
+}
+
+
+int console_available() {
+    return Serial.available();
+}
+
+
+int console_read() {
+    return Serial.read();
+}
+
+
+void console_printf(const char* format, ...) {
+    char buffer[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    Serial.print(buffer);
+}
+
+//
+// Heap
+//
+
+HeapStats heap_stats() {
+    const int32_t total = ESP.getHeapSize();
+    return {0, total - static_cast<int32_t>(ESP.getFreeHeap()), total - static_cast<int32_t>(ESP.getMinFreeHeap())};
+}
+
+//
+// Sleep and power
+//
+
+WakeupCause wakeup_cause() {
+    switch (esp_sleep_get_wakeup_cause()) {
+        case ESP_SLEEP_WAKEUP_EXT0:     return WakeupCause::Ext0;
+        case ESP_SLEEP_WAKEUP_EXT1:     return WakeupCause::Ext1;
+        case ESP_SLEEP_WAKEUP_TIMER:    return WakeupCause::Timer;
+        case ESP_SLEEP_WAKEUP_TOUCHPAD: return WakeupCause::Touchpad;
+        case ESP_SLEEP_WAKEUP_ULP:      return WakeupCause::Ulp;
+        default:                        return WakeupCause::Undefined;
+    }
+}
+
+
+void deep_sleep(uint64_t duration_us, uint8_t wakeup_pin) {
+    if (duration_us > 0) { esp_sleep_enable_timer_wakeup(duration_us); }
+    esp_sleep_enable_ext0_wakeup(static_cast<gpio_num_t>(wakeup_pin), 1);
+    esp_deep_sleep_start();
+    /*reboot*/
+}
+
+
+void restart() {
+    ESP.restart();
+    while (1) { }
+}
+
+
+void halt() {
+    while (1) { }
+}
+
+
+bool ulp_monitor_start(uint8_t pin, const UlpMonitor& monitor) {
+    const gpio_num_t gpio = static_cast<gpio_num_t>(pin);
+    const int8_t channel = digitalPinToAnalogChannel(pin);  // ADC2 channels count from 10
+    if (channel < 0 || !rtc_gpio_is_valid_gpio(gpio)) { 
+        return false; 
+    }
+    const uint32_t sar = (channel >= 10) ? 1 : 0;
+    const uint32_t mux = (channel % 10) + 1;
+
+    // Input with pulldown while asleep, like during is_water_leak_detected()
+    rtc_gpio_init(gpio);
+    rtc_gpio_set_direction(gpio, RTC_GPIO_MODE_INPUT_ONLY);
+    rtc_gpio_pullup_dis(gpio);
+    rtc_gpio_pulldown_en(gpio);
+
+    // Conversions started by the ULP instead of the digital controller
+    if (sar == 0) {
+        adc1_config_channel_atten(static_cast<adc1_channel_t>(channel), ADC_ATTEN_DB_11);
+        adc1_ulp_enable();
+    } else {
+        adc2_config_channel_atten(static_cast<adc2_channel_t>(channel - 10), ADC_ATTEN_DB_11);
+        CLEAR_PERI_REG_MASK(SENS_SAR_MEAS_START2_REG, SENS_MEAS2_START_FORCE | SENS_SAR2_EN_PAD_FORCE);
+    }
+
+    enum { LABEL_ABOVE, LABEL_COUNTING };
+    const ulp_insn_t program[] = {
+        I_MOVI(R3, 0),                  // Data words from address 0
+        I_ADCR(R0, sar, mux),
+        I_ST(R0, R3, ULP_LAST),
+        I_LD(R1, R3, ULP_SAMPLES),
+        I_ADDI(R1, R1, 1),
+        I_ST(R1, R3, ULP_SAMPLES),
+
+        // threshold - reading, overflows when the reading is above
+        I_LD(R1, R3, ULP_THRESHOLD),
+        I_SUBR(R1, R1, R0),
+        M_BXF(LABEL_ABOVE),
+        I_MOVI(R1, 0),
+        I_ST(R1, R3, ULP_RUN),
+        I_HALT(),
+
+        // run - count, overflows while short of it. Otherwise wake and stop the ULP timer
+        M_LABEL(LABEL_ABOVE),
+        I_LD(R1, R3, ULP_RUN),
+        I_ADDI(R1, R1, 1),
+        I_ST(R1, R3, ULP_RUN),
+        I_LD(R2, R3, ULP_COUNT),
+        I_SUBR(R2, R1, R2),
+        M_BXF(LABEL_COUNTING),
+        I_WAKE(),
+        I_END(),
+        M_LABEL(LABEL_COUNTING),
+        I_HALT()
+    };
+
+    RTC_SLOW_MEM[ULP_THRESHOLD] = monitor.threshold;
+    RTC_SLOW_MEM[ULP_COUNT] = monitor.count;
+    RTC_SLOW_MEM[ULP_RUN] = 0;
+    RTC_SLOW_MEM[ULP_LAST] = 0;
+    RTC_SLOW_MEM[ULP_SAMPLES] = 0;
+
+    size_t size = sizeof(program) / sizeof(ulp_insn_t);
+    if (ulp_process_macros_and_load(ULP_PROGRAM, program, &size) != ESP_OK) {
+        return false;
+    }
+    ulp_set_wakeup_period(0, monitor.interval_us);
+    esp_sleep_enable_ulp_wakeup();
+    return (ulp_run(ULP_PROGRAM) == ESP_OK);
+}
+
+
+UlpState ulp_monitor_state() {
+    UlpState state;
+    state.run = RTC_SLOW_MEM[ULP_RUN] & 0xFFFF;
+    state.last = RTC_SLOW_MEM[ULP_LAST] & 0xFFFF;
+    state.samples = RTC_SLOW_MEM[ULP_SAMPLES] & 0xFFFF;
+    return state;
+}
+
+//
+// Task
+//
+
+bool Task::start(const char* name, Function function, void* argument, uint8_t core, uint32_t stack_size) {
+    _function = function;
+    _argument = argument;
+    _done = xSemaphoreCreateBinary();
+    if (!_done) { return false; }
+
+    if (xTaskCreatePinnedToCore(entry, name, stack_size, this, 1, nullptr, core) != pdPASS) {
+        vSemaphoreDelete(static_cast<SemaphoreHandle_t>(_done));
+        _done = nullptr;
+        return false;
+    }
+    _is_started = true;
+    return true;
+}
+
+
+void Task::join() {
+    if (!_is_started) { return; }
+
+    xSemaphoreTake(static_cast<SemaphoreHandle_t>(_done), portMAX_DELAY);
+    vSemaphoreDelete(static_cast<SemaphoreHandle_t>(_done));
+    _done = nullptr;
+    _is_started = false;
+}
+
+
+void Task::entry(void* task) {
+    Task* self = static_cast<Task*>(task);
+    self->_function(self->_argument);
+
+    xSemaphoreGive(static_cast<SemaphoreHandle_t>(self->_done));
+    vTaskDelete(nullptr);
+}
+
+//
+// UART stream
+//
+
+void Uart::begin(uint32_t baud, uint8_t rx_pin, uint8_t tx_pin) {
+    port_serial(_port).begin(baud, SERIAL_8N1, rx_pin, tx_pin);
+}
+
+
+void Uart::set_baud(uint32_t baud) {
+    port_serial(_port).flush();
+    port_serial(_port).updateBaudRate(baud);
+}
+
+
+void Uart::end() {
+    port_serial(_port).end();
+}
+
+
+int Uart::available() {
+    return port_serial(_port).available();
+}
+
+
+int Uart::read() {
+    return port_serial(_port).read();
+}
+
+
+size_t Uart::read(uint8_t* buffer, size_t size) {
+    return port_serial(_port).read(buffer, size);
+}
+
+
+size_t Uart::write(uint8_t byte) {
+    return port_serial(_port).write(byte);
+}
+
+
+size_t Uart::write(const uint8_t* data, size_t size) {
+    return port_serial(_port).write(data, size);
+}
+
+
+void Uart::flush() {
+    port_serial(_port).flush();
+}
+} // Namespace hal
@@ -0,0 +1,706 @@
+
+#include "hal/hal_native.h"
+#include <malloc.h>
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace hal {
+
+struct RxByte {
+    uint64_t time_us;   // Arrival
+    uint8_t byte;
+};
+
+struct UartState {
+    static constexpr size_t RX_SIZE = 8192;
+
+    native::UartPeer* peer = nullptr;
+    uint32_t baud = 0;
+    RxByte rx[RX_SIZE];                 // Fixed ring, no heap on the firmware side
+    size_t rx_head = 0;
+    size_t rx_tail = 0;
+    uint64_t rx_last_us = 0;
+    uint64_t tx_free_us = 0;
+    native::UartStats stats = {};
+};
+
+// Stand-in code (peers, hooks) runs paused, so only firmware allocations are counted
+struct HeapPause {
+    HeapPause() { depth++; }
+    ~HeapPause() { depth--; }
+    static int depth;
+};
+int HeapPause::depth = 0;
+
+static uint64_t clock_us = 0;
+static uint64_t reset_at_us = UINT64_MAX;
+static Level input_level[native::NUM_OF_PINS] = {};
+static Level output_level[native::NUM_OF_PINS] = {};     // Pads
+static Level written_level[native::NUM_OF_PINS] = {};    // Last gpio_write(), the pad unless held
+static bool is_pad_held[native::NUM_OF_PINS] = {};
+static uint16_t adc_value[native::NUM_OF_PINS] = {};
+static native::AdcSource adc_source = nullptr;
+static void* adc_context = nullptr;
+static native::GpioHook gpio_hook = nullptr;
+static void* gpio_context = nullptr;
+static native::ExitHook exit_hook = nullptr;
+static uint8_t store_cache[native::STORE_SIZE];
+static size_t store_size = 0;
+static UartState uarts[3];
+static HeapStats heap = {};
+
+
+static uint64_t byte_time_us(uint32_t baud) {
+    return (baud > 0) ? (10 * 1000000ULL) / baud : 0; // 8N1, 10 bits per byte
+}
+
+
+// RTC_DATA_ATTR and RTC_NOINIT_ATTR variables, linker provided bounds of their sections
+extern "C" __attribute__((weak)) uint8_t __start_rtc_data[];
+extern "C" __attribute__((weak)) uint8_t __stop_rtc_data[];
+extern "C" __attribute__((weak)) uint8_t __start_rtc_noinit[];
+extern "C" __attribute__((weak)) uint8_t __stop_rtc_noinit[];
+
+
+static size_t rtc_data_size() {
+    const size_t size = __stop_rtc_data - __start_rtc_data;
+    return (size < native::RTC_SIZE) ? size : native::RTC_SIZE;
+}
+
+
+static size_t rtc_noinit_size() {
+    const size_t size = __stop_rtc_noinit - __start_rtc_noinit;
+    return (size < native::RTC_SIZE) ? size : native::RTC_SIZE;
+}
+
+
+[[noreturn]] static void exit_boot(native::ExitReason reason) {
+    native::Persistent& state = native::persistent();
+    state.exit_reason = reason;
+    reset_at_us = UINT64_MAX;   // The exit hook reads the clock
+
+    // Like ESP-IDF: RTC_DATA_ATTR is reloaded on any reset, RTC_NOINIT_ATTR only lost with power
+    if (reason == native::ExitReason::DeepSleep) {
+        memcpy(state.rtc, __start_rtc_data, rtc_data_size());
+    }
+    if (reason != native::ExitReason::Halt) {
+        memcpy(state.rtc_noinit, __start_rtc_noinit, rtc_noinit_size());
+    }
+    state.exit_time_us = clock_us;
+    memcpy(state.gpio_level, output_level, sizeof(output_level));
+    const bool is_sleeping = (reason == native::ExitReason::DeepSleep);
+    for (size_t pin = 0; pin < native::NUM_OF_PINS; pin++) {
+        state.gpio_held[pin] = is_sleeping && is_pad_held[pin];
+    }
+    state.heap = heap;
+
+    HeapPause pause;
+    if (exit_hook) { exit_hook(); }
+
+    fflush(stdout);
+    _exit(0);
+}
+
+//
+// Clock
+//
+
+static void check_reset() {
+    if (clock_us >= reset_at_us) { exit_boot(native::ExitReason::Reset); }
+}
+
+
+uint32_t millis() {
+    clock_us++; // Reading the clock is not free, keeps polling loops moving
+    check_reset();
+    return static_cast<uint32_t>(clock_us / 1000);
+}
+
+
+uint32_t micros() {
+    clock_us++;
+    check_reset();
+    return static_cast<uint32_t>(clock_us);
+}
+
+
+uint32_t boot_micros() {
+    return micros(); // The virtual clock starts at setup(), no ROM or bootloader
+}
+
+
+void delay(uint32_t ms) {
+    clock_us += static_cast<uint64_t>(ms) * 1000;
+    check_reset();
+}
+
+//
+// GPIO and ADC
+//
+
+void gpio_mode(uint8_t pin, PinMode mode) {
+    (void)pin;
+    (void)mode;
+}
+
+
+void gpio_write(uint8_t pin, Level level) {
+    if (pin >= native::NUM_OF_PINS) { return; }
+
+    written_level[pin] = level;
+    if (is_pad_held[pin]) { return; }
+    output_level[pin] = level;
+
+    HeapPause pause;
+    if (gpio_hook) { gpio_hook(pin, level, gpio_context); }
+}
+
+
+void gpio_hold(uint8_t pin, bool is_held) {
+    if (pin >= native::NUM_OF_PINS || is_pad_held[pin] == is_held) { return; }
+
+    // Released: the pad takes the last written level, low after a wake without writes
+    is_pad_held[pin] = is_held;
+    if (!is_held && output_level[pin] != written_level[pin]) {
+        output_level[pin] = written_level[pin];
+
+        HeapPause pause;
+        if (gpio_hook) { gpio_hook(pin, output_level[pin], gpio_context); }
+    }
+}
+
+
+Level gpio_read(uint8_t pin) {
+    return (pin < native::NUM_OF_PINS) ? input_level[pin] : Level::Low;
+}
+
+
+uint16_t adc_read(uint8_t pin) {
+    clock_us += 10; // Single conversion
+    if (adc_source) {
+        HeapPause pause;
+        return adc_source(pin, clock_us, adc_context);
+    }
+    return (pin < native::NUM_OF_PINS) ? adc_value[pin] : 0;
+}
+
+
+void adc_scan(const uint8_t* pins, size_t num_of_pins, uint16_t* samples, size_t count, uint32_t interval_us) {
+    uint64_t next_us = clock_us;
+
+    for (size_t i = 0; i < count; i++) {
+        if (i > 0) {
+            next_us += interval_us;
+            if (clock_us < next_us) { clock_us = next_us; }
+        }
+        for (size_t p = 0; p < num_of_pins; p++) {
+            samples[i * num_of_pins + p] = adc_read(pins[p]);
+        }
+    }
+}
+
+//
+// Led
+//
+
+void led_begin(uint8_t pin) {
+    (void)pin;
+}
+
+
+void led_show(Rgb color) {
+    (void)color;
+    clock_us += 30; // WS2812B frame
+}
+
+
+void led_end() {
+}
+
+//
+// Persistent store, written back on commit only (like the flash emulated EEPROM)
+//
+
+bool store_begin(size_t size) {
+    if (size > native::STORE_SIZE) { return false; }
+
+    store_size = size;
+    memcpy(store_cache, native::persistent().store, size);
+    return true;
+}
+
+
+uint8_t store_read(int address) {
+    return (static_cast<size_t>(address) < store_size) ? store_cache[address] : 0;
+}
+
+
+void store_write(int address, uint8_t value) {
+    if (static_cast<size_t>(address) < store_size) {
+        store_cache[address] = value;
+    }
+}
+
+
+bool store_commit() {
+    native::Persistent& state = native::persistent();
+    memcpy(state.store, store_cache, store_size);
+    state.store_commits++;
+    return true;
+}
+
+
+void store_end() {
+    store_size = 0;
+}
+
+//
+// Raw flash partition, NOR semantics and typical SPI flash timing
+//
+
+static constexpr uint32_t FLASH_ERASE_US = 45000;          // 4 KB sector erase
+static constexpr uint32_t FLASH_WRITE_US = 20;             // Per program operation
+static constexpr uint32_t FLASH_WRITE_US_PER_BYTE = 3;     // ~0.7 ms per 256 B page
+static constexpr uint32_t FLASH_READ_US_PER_BYTE = 0;      // Memory mapped, cached
+
+
+size_t Flash::begin(const char* label) {
+    const native::FlashPartition* partition = native::find_partition(label);
+    _partition = partition;
+    _base = partition ? partition->offset : 0;
+    _size = partition ? partition->size : 0;
+    return _size;
+}
+
+
+bool Flash::read(uint32_t offset, void* data, size_t size) {
+    if (!_partition || offset + size > _size) { return false; }
+
+    clock_us += 1 + size * FLASH_READ_US_PER_BYTE;
+    memcpy(data, native::persistent().flash + _base + offset, size);
+    return true;
+}
+
+
+bool Flash::write(uint32_t offset, const void* data, size_t size) {
+    if (!_partition || offset + size > _size) { return false; }
+    native::Persistent& state = native::persistent();
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+
+    clock_us += FLASH_WRITE_US + size * FLASH_WRITE_US_PER_BYTE;
+    for (size_t i = 0; i < size; i++) {
+        state.flash[_base + offset + i] &= bytes[i];
+    }
+    state.flash_writes++;
+    return true;
+}
+
+
+bool Flash::erase_sector(uint32_t offset) {
+    if (!_partition || offset % FLASH_SECTOR_SIZE != 0 || offset >= _size) { return false; }
+    native::Persistent& state = native::persistent();
+
+    clock_us += FLASH_ERASE_US;
+    memset(state.flash + _base + offset, 0xFF, FLASH_SECTOR_SIZE);
+    state.flash_erases[(_base + offset) / FLASH_SECTOR_SIZE]++;
+    return true;
+}
+
+//
+// USB serial console
+//
+
+void console_begin(uint32_t baud) {
+    (void)baud;
+}
+
+
+int console_available() {
+    return 0;
+}
+
+
+int console_read() {
+    return -1;
+}
+
+
+void console_printf(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+}
+
+//
+// Heap, counted through the operator new/delete replacements below
+//
+
+HeapStats heap_stats() {
+    return heap;
+}
+
+
+static void count_allocation(void* memory) {
+    if (!memory || HeapPause::depth > 0) { return; }
+
+    heap.allocations++;
+    heap.in_use_bytes += malloc_usable_size(memory);
+    if (heap.in_use_bytes > heap.peak_bytes) {
+        heap.peak_bytes = heap.in_use_bytes;
+    }
+}
+
+
+static void count_free(void* memory) {
+    if (!memory || HeapPause::depth > 0) { return; }
+    heap.in_use_bytes -= malloc_usable_size(memory);
+}
+
+//
+// Sleep and power
+//
+
+WakeupCause wakeup_cause() {
+    return native::persistent().wakeup_cause;
+}
+
+
+void deep_sleep(uint64_t duration_us, uint8_t wakeup_pin) {
+    (void)wakeup_pin;
+    native::persistent().sleep_duration_us = duration_us;
+    exit_boot(native::ExitReason::DeepSleep);
+}
+
+
+void restart() {
+    exit_boot(native::ExitReason::Restart);
+}
+
+
+void halt() {
+    exit_boot(native::ExitReason::Halt);
+}
+
+
+bool ulp_monitor_start(uint8_t pin, const UlpMonitor& monitor) {
+    native::Persistent& state = native::persistent();
+    state.ulp_pin = pin;
+    state.ulp_monitor = monitor;
+    state.ulp_state = {};
+    state.is_ulp_running = true;
+    return true;
+}
+
+
+UlpState ulp_monitor_state() {
+    return native::persistent().ulp_state;
+}
+
+//
+// Task, run at join() from its own start time. The caller continues at whichever
+// timeline ends later, like two cores meeting again
+//
+
+bool Task::start(const char* name, Function function, void* argument, uint8_t core, uint32_t stack_size) {
+    (void)name;
+    (void)core;
+    (void)stack_size;
+    _function = function;
+    _argument = argument;
+    _start_us = clock_us;
+    _is_started = true;
+    return true;
+}
+
+
+void Task::join() {
+    if (!_is_started) { return; }
+    _is_started = false;
+
+    const uint64_t caller_us = clock_us;
+    clock_us = _start_us;
+    entry(this);
+    if (caller_us > clock_us) { clock_us = caller_us; }
+}
+
+
+void Task::entry(void* task) {
+    Task* self = static_cast<Task*>(task);
+    self->_function(self->_argument);
+}
+
+//
+// UART stream
+//
+
+void Uart::begin(uint32_t baud, uint8_t rx_pin, uint8_t tx_pin) {
+    (void)rx_pin;
+    (void)tx_pin;
+    UartState& uart = uarts[_port];
+    uart.baud = baud;
+    uart.stats = {};
+
+    HeapPause pause;
+    if (uart.peer) { uart.peer->on_begin(baud); }
+}
+
+
+void Uart::set_baud(uint32_t baud) {
+    flush();
+    uarts[_port].baud = baud;
+}
+
+
+void Uart::end() {
+    UartState& uart = uarts[_port];
+    uart.baud = 0;
+    uart.rx_tail = uart.rx_head;
+
+    HeapPause pause;
+    if (uart.peer) { uart.peer->on_end(); }
+}
+
+
+int Uart::available() {
+    const UartState& uart = uarts[_port];
+    if (uart.peer && uart.baud > 0) {
+        HeapPause pause;
+        uart.peer->on_poll(clock_us);
+    }
+
+    int count = 0;
+    for (size_t i = uart.rx_tail; i != uart.rx_head; i++) {
+        if (uart.rx[i % UartState::RX_SIZE].time_us > clock_us) { break; }
+        count++;
+    }
+    return count;
+}
+
+
+int Uart::read() {
+    UartState& uart = uarts[_port];
+    if (uart.rx_tail == uart.rx_head) {
+        return -1;
+    }
+    const RxByte& entry = uart.rx[uart.rx_tail % UartState::RX_SIZE];
+    if (entry.time_us > clock_us) {
+        return -1;
+    }
+    uart.rx_tail++;
+    return entry.byte;
+}
+
+
+size_t Uart::read(uint8_t* buffer, size_t size) {
+    size_t count = 0;
+    int byte = 0;
+    while (count < size && (byte = read()) >= 0) {
+        buffer[count++] = static_cast<uint8_t>(byte);
+    }
+    return count;
+}
+
+
+size_t Uart::write(uint8_t byte) {
+    UartState& uart = uarts[_port];
+    if (uart.baud == 0) { return 0; }
+
+    // Byte leaves the wire once the previous ones are out
+    uint64_t start_us = (uart.tx_free_us > clock_us) ? uart.tx_free_us : clock_us;
+    uart.tx_free_us = start_us + byte_time_us(uart.baud);
+    uart.stats.tx_bytes++;
+    uart.stats.wire_us += byte_time_us(uart.baud);
+
+    HeapPause pause;
+    if (uart.peer) { uart.peer->on_receive(byte, uart.tx_free_us); }
+    return 1;
+}
+
+
+size_t Uart::write(const uint8_t* data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        write(data[i]);
+    }
+    return size;
+}
+
+
+void Uart::flush() {
+    const UartState& uart = uarts[_port];
+    if (uart.tx_free_us > clock_us) {
+        clock_us = uart.tx_free_us;
+    }
+}
+
+//
+// Native controls
+//
+
+namespace native {
+
+Persistent& persistent() {
+    static Persistent* state = nullptr;
+
+    // Shared with forked boots, so it outlives each simulated reboot
+    if (!state) {
+        void* memory = mmap(nullptr, sizeof(Persistent), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) { abort(); }
+        state = new (memory) Persistent();
+        memset(state->store, 0xFF, sizeof(state->store)); // Erased flash
+        memset(state->flash, 0xFF, sizeof(state->flash));
+    }
+    return *state;
+}
+
+
+const FlashPartition* find_partition(const char* label) {
+    for (const FlashPartition& partition : FLASH_PARTITIONS) {
+        if (strcmp(partition.label, label) == 0) { return &partition; }
+    }
+    return nullptr;
+}
+
+
+void restore_rtc_memory() {
+    memcpy(__start_rtc_data, persistent().rtc, rtc_data_size());
+    restore_rtc_noinit();
+
+    // Held pads kept their level through the deep sleep
+    for (size_t pin = 0; pin < NUM_OF_PINS; pin++) {
+        if (!persistent().gpio_held[pin]) { continue; }
+        is_pad_held[pin] = true;
+        output_level[pin] = persistent().gpio_level[pin];
+    }
+}
+
+
+void restore_rtc_noinit() {
+    memcpy(__start_rtc_noinit, persistent().rtc_noinit, rtc_noinit_size());
+}
+
+
+void set_reset_at(uint64_t time_us) {
+    reset_at_us = time_us;
+}
+
+
+void set_input(uint8_t pin, Level level) {
+    if (pin < NUM_OF_PINS) { input_level[pin] = level; }
+}
+
+
+void set_adc(uint8_t pin, uint16_t value) {
+    if (pin < NUM_OF_PINS) { adc_value[pin] = value; }
+}
+
+
+void set_adc_source(AdcSource source, void* context) {
+    adc_source = source;
+    adc_context = context;
+}
+
+
+void set_gpio_hook(GpioHook hook, void* context) {
+    gpio_hook = hook;
+    gpio_context = context;
+}
+
+
+void attach_uart_peer(uint8_t port, UartPeer* peer) {
+    uarts[port].peer = peer;
+}
+
+
+void set_exit_hook(ExitHook hook) {
+    exit_hook = hook;
+}
+
+
+uint64_t now_us() {
+    return clock_us;
+}
+
+
+void uart_inject(uint8_t port, const uint8_t* data, size_t size, uint64_t time_us) {
+    UartState& uart = uarts[port];
+    if (uart.baud == 0) { return; }
+
+    // Serialized behind anything already in flight
+    uint64_t arrival_us = (uart.rx_last_us > time_us) ? uart.rx_last_us : time_us;
+    for (size_t i = 0; i < size; i++) {
+        // Overrun, like a full UART driver buffer
+        if (uart.rx_head - uart.rx_tail >= UartState::RX_SIZE) { break; }
+
+        arrival_us += byte_time_us(uart.baud);
+        uart.rx[uart.rx_head++ % UartState::RX_SIZE] = {arrival_us, data[i]};
+        uart.stats.rx_bytes++;
+        uart.stats.wire_us += byte_time_us(uart.baud);
+    }
+    uart.rx_last_us = arrival_us;
+}
+
+
+uint32_t uart_baud(uint8_t port) {
+    return uarts[port].baud;
+}
+
+
+UartStats uart_stats(uint8_t port) {
+    return uarts[port].stats;
+}
+
+
+void uart_clear_rx(uint8_t port) {
+    uarts[port].rx_tail = uarts[port].rx_head;
+    uarts[port].rx_last_us = 0;
+}
+
+
+void reset_heap_stats() {
+    heap = {};
+}
+} // Namespace native
+} // Namespace hal
+
+//
+// Global allocation counting for hal::heap_stats()
+//
+
+void* operator new(size_t size) {
+    void* memory = malloc(size ? size : 1);
+    if (!memory) { throw std::bad_alloc(); }
+    hal::count_allocation(memory);
+    return memory;
+}
+
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+
+void operator delete(void* memory) noexcept {
+    hal::count_free(memory);
+    free(memory);
+}
+
+
+void operator delete[](void* memory) noexcept {
+    operator delete(memory);
+}
+
+
+void operator delete(void* memory, size_t size) noexcept {
+    (void)size;
+    operator delete(memory);
+}
+
+
+void operator delete[](void* memory, size_t size) noexcept {
+    (void)size;
+    operator delete(memory);
+}
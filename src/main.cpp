@@ -11,27 +11,56 @@ GsmModule sms;
 
 // Main
 void setup() {
+    // Timer wake with nothing to do: power off before anything is initialized
+    shutdown_on_idle_wakeup();
     begin_hardware(&memory, &sms);
 
     // Diagnostic test button
     if (is_test_button_pressed()) {
-        sms.send_message(SMSType::Diagnostic);
+        if (sms.send_message(SMSType::Diagnostic) == SendResult::GivenUp) { error(); }
         system_shutdown();
     }
 
     // Did we wake up from deepsleep? (reboots itself after deepsleep)
     if (woke_up_from_deepsleep()) {
+        // Leak alerted earlier: follow up while it persists, the SIM800L may still be registered
+        if (is_realert_due()) {
+            sms.begin_async();
+            if (is_water_leak_detected()) {
+                if (sms.send_message(SMSType::Alert, get_leak_probes()) == SendResult::GivenUp) { led_blink(4, Color::Red, 250); }
+                deepsleep(schedule_realert());
+                /*OFF*/
+            }
+            end_realert();  // Dry again
+        }
+
+        // Messages that failed on an earlier wake, without running the leak test again
+        if (is_retry_due()) {
+            sms.begin_async();
+            if (sms.send_pending() == SendResult::GivenUp) { error(); }
+        }
         system_shutdown();
     }
 
-    // Normal boot
-    memory.increment_eeprom_count(MemAddr::BootCount, 1, false);  
+    // Normal boot, woken by the leak circuit. Bring the SIM800L up meanwhile (other core)
+    sms.begin_async();
+    const bool is_leak = is_water_leak_detected();
+    memory.increment_eeprom_count(MemAddr::BootCount);  // Counters are mounted after the decision
 
-    if (is_water_leak_detected()) {
-        sms.send_message(SMSType::Alert);
-        deepsleep(DEEPSLEEP_DURATION_LONG);  // Deepsleep to prevent retriggering
+    if (is_leak) {
+        // Not delivered still sleeps for the re-alert, the leak is checked and alerted again
+        if (sms.send_message(SMSType::Alert, get_leak_probes()) == SendResult::GivenUp) { led_blink(4, Color::Red, 250); }
+        deepsleep(schedule_realert());  // Deepsleep to prevent retriggering, wakes to re-check
         /*OFF*/
     } else {
+        sms.cancel_async();
+        #if ULP_LEAK_MONITOR_ENABLED
+            // No timer wake: the ULP watches the sensor, the cores wake only once it reads wet
+            if (start_leak_monitor()) {
+                deepsleep(0);
+                /*OFF*/
+            }
+        #endif
         deepsleep(DEEPSLEEP_DURATION_SHORT);  // False positive
         /*OFF*/
     }
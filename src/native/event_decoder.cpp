@@ -0,0 +1,138 @@
+
+#include "native/event_decoder.h"
+#include "core/leak_classifier.h"
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+namespace event_decoder {
+
+static const char* wake_name(uint8_t cause) {
+    switch (static_cast<hal::WakeupCause>(cause)) {
+        case hal::WakeupCause::Ext0:    return "button";
+        case hal::WakeupCause::Timer:   return "timer";
+        case hal::WakeupCause::Ulp:     return "ulp";
+        default:                        return "power";
+    }
+}
+
+
+static const char* leak_name(uint8_t decision) {
+    switch (static_cast<LeakDecision>(decision)) {
+        case LeakDecision::Leak:        return "leak";
+        case LeakDecision::NoLeak:      return "dry";
+        default:                        return "-";
+    }
+}
+
+
+static const char* sms_type_name(uint8_t sms_type) {
+    switch (static_cast<SMSType>(sms_type)) {
+        case SMSType::Alert:            return "alert";
+        case SMSType::Diagnostic:       return "diagnostic";
+        default:                        return "-";
+    }
+}
+
+
+static const char* status_name(uint8_t status) {
+    switch (static_cast<SmsStatus>(status)) {
+        case SmsStatus::Sent:           return "sent";
+        case SmsStatus::Skipped:        return "skipped";
+        case SmsStatus::NoPrompt:       return "no-prompt";
+        case SmsStatus::Rejected:       return "rejected";
+        case SmsStatus::Timeout:        return "timeout";
+        case SmsStatus::NoNetwork:      return "no-network";
+        default:                        return "pending";
+    }
+}
+
+
+// "1+3": wet probes numbered from 1, "-" for none or records from before probes were logged
+static void format_probes(const event_log::Record& record, char* buffer, size_t size) {
+    size_t length = 0;
+    buffer[0] = '\0';
+    for (size_t i = 0; record.version >= 2 && i < 8 && length + 4 < size; i++) {
+        if (!(record.leak_probes & (1 << i))) { continue; }
+        length += snprintf(buffer + length, size - length, "%s%zu", (length > 0) ? "+" : "", i + 1);
+    }
+    if (length == 0) { snprintf(buffer, size, "-"); }
+}
+
+
+static void print_recipients(const event_log::Record& record) {
+    const size_t count = std::min<size_t>(record.num_of_recipients, event_log::MAX_RECIPIENTS);
+
+    for (size_t i = 0; i < count; i++) {
+        const event_log::Recipient& recipient = record.recipients[i];
+        printf("%s%s/%u/%u", (i > 0) ? " " : "", status_name(recipient.status), recipient.reference, recipient.duration_ms);
+    }
+    if (record.num_of_recipients > count) {
+        printf(" +%u", record.num_of_recipients - static_cast<unsigned>(count));
+    }
+}
+
+
+int decode(const char* path, bool is_csv) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return 1;
+    }
+
+    // Valid records anywhere in the dump, oldest first
+    std::vector<event_log::Record> records;
+    event_log::Record record;
+    size_t skipped = 0;
+    while (fread(&record, sizeof(record), 1, file) == 1) {
+        if (event_log::is_valid(record)) {
+            records.push_back(record);
+        } else if (record.sequence != 0xFFFFFFFF) {
+            skipped++;
+        }
+    }
+    fclose(file);
+    std::sort(records.begin(), records.end(), [](const auto& a, const auto& b) { return a.sequence < b.sequence; });
+
+    if (is_csv) {
+        printf("sequence,wake,leak,probes,adc_mean,adc_max,adc_samples,csq,operator,modem_ready_ms");
+        for (const char* phase : event_log::PHASE_NAMES) { printf(",%s_ms", phase); }
+        printf(",awake_ms,sms,recipients\n");
+    } else {
+        printf("%8s %-6s %-5s %-6s %13s %4s %-8s %6s", "seq", "wake", "leak", "probes", "adc mean/max/n", "csq", "operator", "ready");
+        for (const char* phase : event_log::PHASE_NAMES) { printf(" %6s", phase); }
+        printf(" %7s %-10s %s\n", "awake", "sms", "recipients (status/ref/ms)");
+    }
+
+    for (const event_log::Record& entry : records) {
+        char operator_name[sizeof(entry.operator_name) + 1] = {};
+        memcpy(operator_name, entry.operator_name, sizeof(entry.operator_name));
+        char probes[24];
+        format_probes(entry, probes, sizeof(probes));
+
+        if (is_csv) {
+            printf("%u,%s,%s,%s,%u,%u,%u,%u,%s,%u", entry.sequence, wake_name(entry.wake_cause), leak_name(entry.leak_decision),
+                probes, entry.adc_mean, entry.adc_max, entry.adc_samples, entry.csq, operator_name, entry.modem_ready_ms);
+            for (uint16_t phase_ms : entry.phase_ms) { printf(",%u", phase_ms); }
+            printf(",%u,%s,", entry.awake_ms, sms_type_name(entry.sms_type));
+        } else {
+            char adc[24];
+            snprintf(adc, sizeof(adc), "%u/%u/%u", entry.adc_mean, entry.adc_max, entry.adc_samples);
+            printf("%8u %-6s %-5s %-6s %13s %4u %-8s %6u", entry.sequence, wake_name(entry.wake_cause), 
+                leak_name(entry.leak_decision), probes, adc, entry.csq, operator_name[0] ? operator_name : "-", entry.modem_ready_ms);
+            for (uint16_t phase_ms : entry.phase_ms) { printf(" %6u", phase_ms); }
+            printf(" %7u %-10s ", entry.awake_ms, sms_type_name(entry.sms_type));
+        }
+        print_recipients(entry);
+        printf("\n");
+    }
+
+    if (!is_csv) {
+        printf("%zu records", records.size());
+        if (skipped > 0) { printf(", %zu torn or foreign skipped", skipped); }
+        printf("\n");
+    }
+    return 0;
+}
+} // Namespace event_decoder
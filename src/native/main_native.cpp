@@ -0,0 +1,847 @@
+
+#include "config.h"
+#include "core/energy.h"
+#include "core/hardware.h"
+#include "core/memory.h"
+#include "core/wire_capture.h"
+#include "hal/hal_native.h"
+#include "native/event_decoder.h"
+#include "native/sim_modem.h"
+#include "native/wire_decoder.h"
+#include "trace.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+// Host runner for [env:native]. Every simulated boot runs setup()/loop() in a forked
+// process so all RAM state starts fresh, like on the ESP32. Flash survives in shared memory
+//
+//   program [--boots N] [--leak | --leak-at MS] [--dry-at MS] [--leak-probes MASK] [--button] [--modem-boot MS] [--network-search MS]
+//           [--no-sim | --network-denied] [--network-at MS] [--modem-baud RATE] [--trace FILE.json] [--dump-events FILE]
+//           [--modem-profile ideal|weak|flaky] [--modem-latency MS] [--modem-jitter MS] [--modem-fragment BYTES:US]
+//           [--modem-noise RATE] [--modem-errors RATE] [--modem-drops RATE] [--seed N] [--modem-transcript FILE]
+//           [--wire-dump FILE] [--reset-at MS]
+//   program --adc-replay FILE
+//   program --adc-noise N [--adc-correlation US] [--seed N]
+//   program --journal-years N [--boots-per-day N]
+//   program --decode-events FILE [--csv]
+//   program --decode-wire FILE [--csv]
+//
+// --leak-at wets the sensor at that point of the runner timeline (awake and asleep time),
+// e.g. while the ULP monitor watches it during deep sleep. --dry-at ends the leak, e.g.
+// between re-alert checks. --leak-probes picks the probes that get wet, bit per LEAK_PROBES
+// entry (1, the first probe, by default)
+//
+// --adc-replay runs the leak test over recorded ADC traces, one per line:
+// "<0|1> sample sample ..." (0 dry, 1 wet, '#' comment). Reports decision latency and
+// error rates. Traces come from the debug menu ('l') or any other recording
+//
+// --adc-noise runs the leak test N times dry and N times wet (the first probe at its
+// wet_mean) with LEAK_ADC_NOISE that wanders with the --adc-correlation time constant
+// (2000 us by default), like supply ripple while the modem powers up. Reports the same
+// as --adc-replay, to hold against LEAK_FALSE_ALARM_RATE and LEAK_MISS_RATE
+//
+// --journal-years drives the counter journal through years of boots (boot count every
+// boot, an alert every 100, a diagnostic every 500, one flush per boot) and reports
+// commit latency and sector erases against the old one commit per change EEPROM layout
+//
+// --reset-at resets the boot running at that point of the runner timeline, like a watchdog,
+// panic or brownout. The next boot starts without a wake cause: RTC_DATA_ATTR variables
+// start over, RTC_NOINIT_ATTR ones (staged counters, outbox) are kept as on the ESP32
+//
+// --network-at leaves the module without coverage until that point of the runner timeline,
+// e.g. to watch undelivered messages being retried on later wakes
+//
+// --modem-profile starts from a preset (weak: fringe coverage, flaky: weak plus noise and
+// failures), the other --modem-* options adjust it when given after it. Rates are per byte
+// (noise) or per command (errors, drops). Draws are seeded from --seed and the boot number,
+// the same command line gives the same run
+//
+// --modem-transcript answers from a recorded session instead, one line each way:
+// "<ms> > AT+CSQ" sent by the ESP32, "<ms> < +CSQ: 17,0" sent by the module, ms since
+// power on ('#' comment, "<ms> < >" the SMS prompt, an SMS body ends with "^Z"). Commands
+// match by name, recorded ones the firmware skips are passed over
+//
+// --modem-baud is the rate the module keeps from an earlier AT+IPR (0 auto-bauding, the
+// default), e.g. a swapped module the firmware has to find. Carried over between boots
+//
+// --dump-events writes the events partition after the boots, --decode-events prints a
+// dump as a table (or CSV), same format as "esptool.py read_flash 0x218000 0x10000 FILE"
+//
+// --wire-dump writes the modem UART capture of each boot (UART_CAPTURE_ENABLED), the lines
+// the debug menu prints with 'u'. --decode-wire turns either into round trip times per command
+
+void setup();
+void loop();
+
+struct Options {
+    uint32_t boots = 1;
+    uint64_t leak_at_us = UINT64_MAX;   // Never
+    uint64_t dry_at_us = UINT64_MAX;
+    uint8_t leak_probes = 1;
+    uint64_t network_at_us = 0;
+    uint64_t reset_at_us = UINT64_MAX;
+    bool button = false;
+    const char* trace_path = nullptr;
+    const char* adc_replay_path = nullptr;
+    uint32_t adc_noise_trials = 0;
+    uint32_t adc_correlation_us = 2000;
+    const char* dump_events_path = nullptr;
+    const char* decode_events_path = nullptr;
+    const char* transcript_path = nullptr;
+    const char* wire_dump_path = nullptr;
+    const char* decode_wire_path = nullptr;
+    bool is_csv = false;
+    uint32_t journal_years = 0;
+    uint32_t boots_per_day = 24;
+    SimModem::Profile modem;
+};
+
+// Recorded ADC trace, consumed one sample per conversion (the last one repeats)
+struct AdcTrace {
+    std::vector<uint16_t> samples;
+    size_t next = 0;
+};
+
+// First order (exponentially correlated) Gaussian noise on the first probe's reading
+struct AdcNoise {
+    float level = 0;                    // Reading without noise
+    float value = 0;
+    uint64_t last_us = UINT64_MAX;      // None yet: the next value is drawn independently
+    uint32_t correlation_us = 0;
+    size_t samples = 0;
+    uint32_t random = 1;                // xorshift32 state, never 0
+};
+
+// Replay results of one class (dry or wet traces)
+struct ReplayStats {
+    uint32_t traces = 0;
+    uint32_t errors = 0;        // False positives (dry) or misses (wet)
+    uint64_t total_us = 0;
+    uint64_t max_us = 0;
+    uint32_t total_samples = 0;
+};
+
+// Filled by each boot at exit, shared with the runner
+struct BootStats {
+    uint32_t sms_sent;
+    uint64_t sms_first_us;      // First AT+CMGS seen by the modem
+    uint64_t sms_last_us;       // Last +CMGS acknowledgement
+    hardware::BootProfile profile;
+    uint32_t modem_state_ms[static_cast<size_t>(ModemState::NumOfStates)];
+    ModemFailure modem_failure;
+    SimModem::Snapshot modem;   // Carried to the next boot
+    ModemStandby modem_standby;
+    uint32_t uart_baud;         // Firmware side at exit
+    hal::native::UartStats uart;
+    float charge[static_cast<size_t>(energy::Phase::NumOfPhases)];   // mAh
+    SimModem::Faults faults;
+    SimModem::ReplayStats replay;
+};
+
+static const char* trace_path = nullptr;
+static const char* wire_dump_path = nullptr;
+static uint32_t current_boot = 0;
+static uint64_t leak_at_us = UINT64_MAX;
+static uint64_t dry_at_us = UINT64_MAX;
+static uint8_t leak_probes = 1;
+static uint64_t boot_start_us = 0;      // Runner timeline when the current boot started
+static bool is_reset_boot = false;      // The last boot ended in a reset, not a power cut
+static constexpr uint8_t MODEM_PORT = 2;
+static constexpr uint64_t ULP_WATCH_LIMIT_US = 24ull * 60 * 60 * 1000000;   // Emulated sleep without a timer wake
+static SimModem* modem_ptr = nullptr;
+static BootStats* boot_stats = nullptr;
+
+
+static const char* wakeup_cause_name(hal::WakeupCause cause) {
+    switch (cause) {
+        case hal::WakeupCause::Timer:   return "timer";
+        case hal::WakeupCause::Ext0:    return "button";
+        case hal::WakeupCause::Ulp:     return "ulp";
+        default:                        return "power";
+    }
+}
+
+
+static const char* exit_reason_name(hal::native::ExitReason reason) {
+    switch (reason) {
+        case hal::native::ExitReason::Halt:         return "power off";
+        case hal::native::ExitReason::DeepSleep:    return "deepsleep";
+        case hal::native::ExitReason::Restart:      return "restart";
+        case hal::native::ExitReason::Reset:        return "reset";
+        default:                                    return "crashed";
+    }
+}
+
+
+static const char* modem_failure_name(ModemFailure failure) {
+    switch (failure) {
+        case ModemFailure::NoModem:     return "no modem";
+        case ModemFailure::NoSim:       return "no sim";
+        case ModemFailure::Denied:      return "denied";
+        case ModemFailure::NoNetwork:   return "no network";
+        case ModemFailure::NotSent:     return "not sent";
+        default:                        return "";
+    }
+}
+
+
+static const char* modem_standby_name(ModemStandby standby) {
+    switch (standby) {
+        case ModemStandby::Sleep:       return "sleep";
+        case ModemStandby::Minimum:     return "radio off";
+        default:                        return "off";
+    }
+}
+
+
+static bool parse_options(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const bool has_value = (i + 1 < argc);
+
+        if (strcmp(arg, "--boots") == 0 && has_value) {
+            options.boots = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(arg, "--leak") == 0) {
+            options.leak_at_us = 0;
+        } else if (strcmp(arg, "--leak-at") == 0 && has_value) {
+            options.leak_at_us = strtoull(argv[++i], nullptr, 10) * 1000;
+        } else if (strcmp(arg, "--dry-at") == 0 && has_value) {
+            options.dry_at_us = strtoull(argv[++i], nullptr, 10) * 1000;
+        } else if (strcmp(arg, "--leak-probes") == 0 && has_value) {
+            options.leak_probes = static_cast<uint8_t>(strtoul(argv[++i], nullptr, 0));
+        } else if (strcmp(arg, "--button") == 0) {
+            options.button = true;
+        } else if (strcmp(arg, "--modem-boot") == 0 && has_value) {
+            options.modem.boot_ms = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(arg, "--network-search") == 0 && has_value) {
+            options.modem.search_ms = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(arg, "--no-sim") == 0) {
+            options.modem.has_sim = false;
+        } else if (strcmp(arg, "--network-denied") == 0) {
+            options.modem.is_denied = true;
+        } else if (strcmp(arg, "--network-at") == 0 && has_value) {
+            options.network_at_us = strtoull(argv[++i], nullptr, 10) * 1000;
+        } else if (strcmp(arg, "--modem-baud") == 0 && has_value) {
+            options.modem.fixed_baud = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(arg, "--modem-profile") == 0 && has_value) {
+            if (!SimModem::preset(argv[++i], options.modem)) {
+                fprintf(stderr, "Unknown modem profile: %s\n", argv[i]);
+                return false;
+            }
+        } else if (strcmp(arg, "--modem-latency") == 0 && has_value) {
+            options.modem.response_ms = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(arg, "--modem-jitter") == 0 && has_value) {
+            options.modem.jitter_ms = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(arg, "--modem-fragment") == 0 && has_value) {
+            char* end = nullptr;
+            options.modem.fragment_bytes = strtoul(argv[++i], &end, 10);
+            options.modem.fragment_gap_us = (*end == ':') ? strtoul(end + 1, nullptr, 10) : 0;
+        } else if (strcmp(arg, "--modem-noise") == 0 && has_value) {
+            options.modem.noise_rate = strtof(argv[++i], nullptr);
+        } else if (strcmp(arg, "--modem-errors") == 0 && has_value) {
+            options.modem.error_rate = strtof(argv[++i], nullptr);
+        } else if (strcmp(arg, "--modem-drops") == 0 && has_value) {
+            options.modem.drop_rate = strtof(argv[++i], nullptr);
+        } else if (strcmp(arg, "--seed") == 0 && has_value) {
+            options.modem.seed = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(arg, "--modem-transcript") == 0 && has_value) {
+            options.transcript_path = argv[++i];
+        } else if (strcmp(arg, "--reset-at") == 0 && has_value) {
+            options.reset_at_us = strtoull(argv[++i], nullptr, 10) * 1000;
+        } else if (strcmp(arg, "--wire-dump") == 0 && has_value) {
+            options.wire_dump_path = argv[++i];
+        } else if (strcmp(arg, "--decode-wire") == 0 && has_value) {
+            options.decode_wire_path = argv[++i];
+        } else if (strcmp(arg, "--trace") == 0 && has_value) {
+            options.trace_path = argv[++i];
+        } else if (strcmp(arg, "--adc-replay") == 0 && has_value) {
+            options.adc_replay_path = argv[++i];
+        } else if (strcmp(arg, "--adc-noise") == 0 && has_value) {
+            options.adc_noise_trials = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(arg, "--adc-correlation") == 0 && has_value) {
+            options.adc_correlation_us = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(arg, "--journal-years") == 0 && has_value) {
+            options.journal_years = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(arg, "--boots-per-day") == 0 && has_value) {
+            options.boots_per_day = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(arg, "--dump-events") == 0 && has_value) {
+            options.dump_events_path = argv[++i];
+        } else if (strcmp(arg, "--decode-events") == 0 && has_value) {
+            options.decode_events_path = argv[++i];
+        } else if (strcmp(arg, "--csv") == 0) {
+            options.is_csv = true;
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", arg);
+            return false;
+        }
+    }
+    return true;
+}
+
+
+static uint16_t sensor_level(uint64_t timeline_us) {
+    return (timeline_us >= leak_at_us && timeline_us < dry_at_us) ? 2048 : 0;
+}
+
+
+static uint16_t sensor_sample(uint8_t pin, uint64_t time_us, void* context) {
+    (void)context;
+    for (size_t i = 0; i < NUM_OF_LEAK_PROBES; i++) {
+        if (LEAK_PROBES[i].pin == pin && (leak_probes & (1 << i))) { return sensor_level(boot_start_us + time_us); }
+    }
+    return 0;
+}
+
+
+// The ULP program while the cores sleep: returns the time it woke them, or the full duration
+static uint64_t emulate_ulp(hal::native::Persistent& state, uint64_t sleep_start_us, uint64_t sleep_us) {
+    const hal::UlpMonitor& monitor = state.ulp_monitor;
+    hal::UlpState& ulp = state.ulp_state;
+
+    for (uint64_t time_us = monitor.interval_us; time_us <= sleep_us; time_us += monitor.interval_us) {
+        ulp.last = (leak_probes & 1) ? sensor_level(sleep_start_us + time_us) : 0;  // Watches the first probe
+        ulp.samples++;
+        ulp.run = (ulp.last > monitor.threshold) ? ulp.run + 1 : 0;
+
+        if (ulp.run >= monitor.count) {
+            state.wakeup_cause = hal::WakeupCause::Ulp;
+            return time_us;
+        }
+    }
+    return sleep_us;
+}
+
+
+static uint16_t replay_sample(uint8_t pin, uint64_t time_us, void* context) {
+    (void)time_us;
+    AdcTrace* trace = static_cast<AdcTrace*>(context);
+
+    // Traces are of the first probe, the others stay dry
+    if (trace->samples.empty() || pin != LEAK_PROBES[0].pin) { return 0; }
+    size_t index = (trace->next < trace->samples.size()) ? trace->next : trace->samples.size() - 1;
+    trace->next++;
+    return trace->samples[index];
+}
+
+
+static uint16_t noise_sample(uint8_t pin, uint64_t time_us, void* context) {
+    AdcNoise* noise = static_cast<AdcNoise*>(context);
+    if (pin != LEAK_PROBES[0].pin) { return 0; }
+
+    // Box-Muller on two xorshift32 draws in (0, 1]
+    float uniform[2];
+    for (float& value : uniform) {
+        noise->random ^= noise->random << 13;
+        noise->random ^= noise->random >> 17;
+        noise->random ^= noise->random << 5;
+        value = (noise->random + 1.0f) / 4294967296.0f;
+    }
+    const float draw = LEAK_ADC_NOISE * sqrtf(-2 * logf(uniform[0])) * cosf(2 * static_cast<float>(M_PI) * uniform[1]);
+
+    // Correlation decays with the time since the last conversion, the variance stays
+    if (noise->last_us == UINT64_MAX || noise->correlation_us == 0) {
+        noise->value = draw;
+    } else {
+        const float rho = expf(-static_cast<float>(time_us - noise->last_us) / noise->correlation_us);
+        noise->value = rho * noise->value + sqrtf(1 - rho * rho) * draw;
+    }
+    noise->last_us = time_us;
+    noise->samples++;
+
+    const float reading = noise->level + noise->value;
+    return (reading > 0) ? static_cast<uint16_t>(reading + 0.5f) : 0;
+}
+
+
+static void count_replay(ReplayStats& stats, bool is_error, uint64_t latency_us, size_t samples) {
+    stats.traces++;
+    stats.errors += is_error;
+    stats.total_us += latency_us;
+    stats.total_samples += samples;
+    if (latency_us > stats.max_us) { stats.max_us = latency_us; }
+}
+
+
+static void print_replay_stats(const char* name, const char* error_name, const ReplayStats& stats) {
+    if (stats.traces == 0) { return; }
+
+    printf("%s: %u traces, %u %s (%.2f%%), latency %.3f ms mean, %.3f ms max, %.1f samples mean\n", name,
+        stats.traces, stats.errors, error_name, stats.errors * 100.0 / stats.traces,
+        stats.total_us / 1000.0 / stats.traces, stats.max_us / 1000.0,
+        static_cast<double>(stats.total_samples) / stats.traces);
+}
+
+
+static int replay_adc(const char* path) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return 1;
+    }
+
+    ReplayStats dry;
+    ReplayStats wet;
+    uint32_t line_num = 0;
+    char line[8192];
+
+    while (fgets(line, sizeof(line), file)) {
+        line_num++;
+        char* cursor = line;
+        while (*cursor == ' ' || *cursor == '\t') { cursor++; }
+        if (*cursor == '#' || *cursor == '\n' || *cursor == '\r' || *cursor == '\0') { continue; }
+
+        if (*cursor != '0' && *cursor != '1') {
+            fprintf(stderr, "%s:%u: label must be 0 (dry) or 1 (wet)\n", path, line_num);
+            continue;
+        }
+        const bool is_wet = (*cursor++ == '1');
+
+        AdcTrace trace;
+        char* end = nullptr;
+        for (unsigned long value = strtoul(cursor, &end, 10); end != cursor; value = strtoul(cursor, &end, 10)) {
+            trace.samples.push_back(static_cast<uint16_t>(value));
+            cursor = end;
+        }
+
+        // The firmware's own leak test, timed on the virtual clock
+        hal::native::set_adc_source(replay_sample, &trace);
+        const uint64_t start_us = hal::native::now_us();
+        const bool is_leak = hardware::is_water_leak_detected();
+        const uint64_t latency_us = hal::native::now_us() - start_us;
+
+        count_replay(is_wet ? wet : dry, is_leak != is_wet, latency_us, trace.next);
+        printf("trace %u: %s -> %s in %.3f ms, %zu samples\n", line_num, is_wet ? "wet" : "dry",
+            is_leak ? "leak" : "no leak", latency_us / 1000.0, trace.next);
+    }
+    fclose(file);
+    hal::native::set_adc_source(nullptr, nullptr);
+
+    print_replay_stats("dry", "false positives", dry);
+    print_replay_stats("wet", "misses", wet);
+    return 0;
+}
+
+
+static int simulate_adc_noise(const Options& options) {
+    ReplayStats dry;
+    ReplayStats wet;
+    AdcNoise noise;
+    noise.correlation_us = options.adc_correlation_us;
+    noise.random = options.modem.seed * 2654435761u + 1;
+    hal::native::set_adc_source(noise_sample, &noise);
+
+    for (uint32_t trial = 0; trial < 2 * options.adc_noise_trials; trial++) {
+        const bool is_wet = (trial % 2 == 1);
+        noise.level = is_wet ? LEAK_PROBES[0].wet_mean : LEAK_ADC_DRY;
+        noise.last_us = UINT64_MAX;
+        noise.samples = 0;
+
+        const uint64_t start_us = hal::native::now_us();
+        const bool is_leak = hardware::is_water_leak_detected();
+        count_replay(is_wet ? wet : dry, is_leak != is_wet, hal::native::now_us() - start_us, noise.samples);
+    }
+    hal::native::set_adc_source(nullptr, nullptr);
+
+    printf("noise: %.1f sigma, %.1f ms time constant, configured %.2f%% false positives, %.2f%% misses\n",
+        LEAK_ADC_NOISE, options.adc_correlation_us / 1000.0, LEAK_FALSE_ALARM_RATE * 100.0, LEAK_MISS_RATE * 100.0);
+    print_replay_stats("dry", "false positives", dry);
+    print_replay_stats("wet", "misses", wet);
+    return 0;
+}
+
+
+static uint64_t timed_us(uint64_t& max_us, void (*operation)()) {
+    const uint64_t start_us = hal::native::now_us();
+    operation();
+    const uint64_t duration_us = hal::native::now_us() - start_us;
+
+    if (duration_us > max_us) { max_us = duration_us; }
+    return duration_us;
+}
+
+
+static int bench_journal(const Options& options) {
+    constexpr uint32_t RATED_ERASE_CYCLES = 100000;    // Typical SPI NOR endurance per sector
+    const uint64_t boots = static_cast<uint64_t>(options.journal_years) * 365 * options.boots_per_day;
+    const hal::native::Persistent& state = hal::native::persistent();
+    Memory memory;
+    uint64_t changes = 0;
+    uint64_t commit_us = 0;
+    uint64_t commit_max_us = 0;
+    uint64_t mount_us = 0;
+    uint64_t mount_max_us = 0;
+
+    for (uint64_t boot = 1; boot <= boots; boot++) {
+        mount_us += timed_us(mount_max_us, [] { Memory memory; memory.begin(); });
+
+        Memory::increment_eeprom_count(MemAddr::BootCount);
+        changes++;
+        if (boot % 100 == 0) {
+            Memory::increment_eeprom_count(MemAddr::SmsSent, 2);
+            changes++;
+        }
+        if (boot % 500 == 0) {
+            Memory::reset_eeprom_count(MemAddr::BootCount);
+            changes++;
+        }
+        commit_us += timed_us(commit_max_us, [] { Memory::flush(); });
+    }
+    if (Memory::get_has_eeprom_failed()) {
+        fprintf(stderr, "Counter journal failed\n");
+        return 1;
+    }
+
+    // Journal sectors only
+    const hal::native::FlashPartition* partition = hal::native::find_partition(JOURNAL_PARTITION);
+    const size_t first_sector = partition->offset / hal::FLASH_SECTOR_SIZE;
+    const size_t num_of_sectors = partition->size / hal::FLASH_SECTOR_SIZE;
+    uint64_t erases = 0;
+    uint32_t max_erases = 0;
+    for (size_t sector = first_sector; sector < first_sector + num_of_sectors; sector++) {
+        erases += state.flash_erases[sector];
+        if (state.flash_erases[sector] > max_erases) { max_erases = state.flash_erases[sector]; }
+    }
+    const double years = options.journal_years;
+
+    printf("journal: %llu boots over %u years, %llu counter changes, sms sent %i\n", static_cast<unsigned long long>(boots),
+        options.journal_years, static_cast<unsigned long long>(changes), memory.get_eeprom_count<int>(MemAddr::SmsSent) - 1);
+    printf("    commit: %.3f ms mean, %.3f ms max (one per boot)\n", commit_us / 1000.0 / boots, commit_max_us / 1000.0);
+    printf("    mount: %.3f ms mean, %.3f ms max\n", mount_us / 1000.0 / boots, mount_max_us / 1000.0);
+    printf("    sector erases: %llu total, %u max per sector (%zu sectors), rated wear in %.0f years\n",
+        static_cast<unsigned long long>(erases), max_erases, num_of_sectors,
+        max_erases ? RATED_ERASE_CYCLES * years / max_erases : 0.0);
+    printf("one sector EEPROM layout: %llu sector erases on one sector, rated wear in %.1f years\n",
+        static_cast<unsigned long long>(changes), RATED_ERASE_CYCLES * years / changes);
+    return 0;
+}
+
+
+static int dump_events(const char* path) {
+    const hal::native::FlashPartition* partition = hal::native::find_partition(EVENTS_PARTITION);
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return 1;
+    }
+
+    fwrite(hal::native::persistent().flash + partition->offset, 1, partition->size, file);
+    fclose(file);
+    return 0;
+}
+
+
+static void on_boot_exit() {
+    boot_stats->sms_sent = modem_ptr->get_sms_sent();
+    boot_stats->sms_first_us = modem_ptr->get_first_cmgs_us();
+    boot_stats->sms_last_us = modem_ptr->get_last_ack_us();
+    boot_stats->profile = hardware::get_boot_profile();
+    boot_stats->modem_failure = GsmModule::get_failure();
+    boot_stats->modem = modem_ptr->snapshot(hal::native::now_us());
+    boot_stats->modem_standby = GsmModule::get_standby();
+    boot_stats->uart_baud = GsmModule::get_baud_rate();
+    boot_stats->uart = hal::native::uart_stats(MODEM_PORT);
+    for (size_t i = 0; i < static_cast<size_t>(ModemState::NumOfStates); i++) {
+        boot_stats->modem_state_ms[i] = GsmModule::get_state_ms(static_cast<ModemState>(i));
+    }
+    for (size_t i = 0; i < static_cast<size_t>(energy::Phase::NumOfPhases); i++) {
+        boot_stats->charge[i] = energy::get_charge(static_cast<energy::Phase>(i));
+    }
+    boot_stats->faults = modem_ptr->get_faults();
+    boot_stats->replay = modem_ptr->get_replay_stats();
+
+    // UART capture, the boot's own clock
+    if (wire_dump_path) {
+        FILE* file = fopen(wire_dump_path, "a");
+        if (file) {
+            char line[32 + 4 * wire_capture::CHUNK_SIZE];
+            fprintf(file, "# boot %u, %u chunks overwritten\n", current_boot, wire_capture::get_overwritten());
+            for (size_t i = 0; i < wire_capture::count(); i++) {
+                wire_capture::format_chunk(wire_capture::at(i), line, sizeof(line));
+                fprintf(file, "%s\n", line);
+            }
+            fclose(file);
+        }
+    }
+
+    // Chrome trace, one track per boot
+    if (trace_path) {
+        FILE* file = fopen(trace_path, "a");
+        if (!file) { return; }
+        trace::export_chrome_json(file, 1, current_boot);
+        fclose(file);
+    }
+}
+
+
+static void run_boot(const Options& options, SimModem& modem) {
+    modem.attach();
+
+    // RTC memory survives deep sleep, RTC_NOINIT_ATTR memory resets as well. Neither the power latch
+    if (hal::native::persistent().wakeup_cause != hal::WakeupCause::Undefined) {
+        hal::native::restore_rtc_memory();
+    } else if (is_reset_boot) {
+        hal::native::restore_rtc_noinit();
+    }
+    if (options.reset_at_us >= boot_start_us) {
+        hal::native::set_reset_at(options.reset_at_us - boot_start_us);
+    }
+
+    hal::native::set_input(PIN_TEST_BUTTON, options.button ? hal::Level::High : hal::Level::Low);
+    hal::native::set_adc_source(sensor_sample, nullptr);
+    hal::native::set_exit_hook(on_boot_exit);
+
+    // Only allocations made by the firmware itself from here on
+    hal::native::reset_heap_stats();
+    setup();
+    loop();
+}
+
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parse_options(argc, argv, options)) {
+        return 1;
+    }
+    if (options.adc_replay_path) {
+        return replay_adc(options.adc_replay_path);
+    }
+    if (options.adc_noise_trials > 0) {
+        return simulate_adc_noise(options);
+    }
+    if (options.journal_years > 0) {
+        return bench_journal(options);
+    }
+    if (options.decode_events_path) {
+        return event_decoder::decode(options.decode_events_path, options.is_csv);
+    }
+    if (options.decode_wire_path) {
+        return wire_decoder::decode(options.decode_wire_path, options.is_csv);
+    }
+
+    hal::native::Persistent& state = hal::native::persistent();
+    state.wakeup_cause = hal::WakeupCause::Undefined;
+    SimModem modem(MODEM_PORT, PIN_SIM800L_POWER_SWITCH, options.modem);
+    modem_ptr = &modem;
+    if (options.transcript_path && !modem.load_transcript(options.transcript_path)) {
+        fprintf(stderr, "Cannot read a transcript from %s\n", options.transcript_path);
+        return 1;
+    }
+    boot_stats = static_cast<BootStats*>(mmap(nullptr, sizeof(BootStats), PROT_READ | PROT_WRITE, 
+        MAP_SHARED | MAP_ANONYMOUS, -1, 0));
+    uint64_t total_us = 0;
+    uint32_t total_sms = 0;
+    uint64_t total_sms_us = 0;
+    uint32_t total_allocations = 0;
+    int32_t peak_bytes = 0;
+    uint32_t decisions = 0;
+    uint64_t total_decision_us = 0;
+    uint32_t max_latch_us = 0;
+    uint32_t max_decision_us = 0;
+    uint32_t sessions = 0;
+    uint64_t total_wire_us = 0;
+    float total_charge = 0;         // mAh
+    SimModem::Faults total_faults = {};
+    SimModem::ReplayStats total_replay = {};
+
+    // Chrome trace (chrome://tracing, ui.perfetto.dev), events are appended by each boot
+    trace_path = options.trace_path;
+    leak_at_us = options.leak_at_us;
+    dry_at_us = options.dry_at_us;
+    leak_probes = options.leak_probes;
+    uint64_t timeline_us = 0;
+    wire_dump_path = options.wire_dump_path;
+    if (wire_dump_path) {
+        if (!UART_CAPTURE_ENABLED) {
+            fprintf(stderr, "--wire-dump needs UART_CAPTURE_ENABLED 1 (config.h)\n");
+            return 1;
+        }
+        FILE* file = fopen(wire_dump_path, "w");
+        if (!file) {
+            fprintf(stderr, "Cannot open %s\n", wire_dump_path);
+            return 1;
+        }
+        fclose(file);
+    }
+    if (trace_path) {
+        FILE* file = fopen(trace_path, "w");
+        if (!file) {
+            fprintf(stderr, "Cannot open %s\n", trace_path);
+            return 1;
+        }
+        fprintf(file, "{\"traceEvents\":[\n");
+        fclose(file);
+    }
+
+    for (uint32_t boot = 1; boot <= options.boots; boot++) {
+        current_boot = boot;
+        const hal::WakeupCause cause = state.wakeup_cause;
+        state.exit_reason = hal::native::ExitReason::None;
+        state.is_ulp_running = false;
+        boot_start_us = timeline_us;
+        *boot_stats = {};
+        boot_stats->modem = modem.snapshot(0); // Unless the boot changes it
+        modem.set_coverage(timeline_us >= options.network_at_us);
+        modem.reseed(options.modem.seed + boot);
+
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid == 0) {
+            run_boot(options, modem);
+            _exit(0);
+        }
+        int status = 0;
+        waitpid(pid, &status, 0);
+
+        total_us += state.exit_time_us;
+        total_allocations += state.heap.allocations;
+        if (state.heap.peak_bytes > peak_bytes) { peak_bytes = state.heap.peak_bytes; }
+
+        printf("boot %u: wake=%s -> %s after %.3f ms, heap: %u allocations, %i B peak\n", boot,
+            wakeup_cause_name(cause), exit_reason_name(state.exit_reason), state.exit_time_us / 1000.0,
+            state.heap.allocations, state.heap.peak_bytes);
+
+        // Reset to power latch and to leak decision (the time a weak battery must hold up)
+        const hardware::BootProfile& profile = boot_stats->profile;
+        if (profile.latch_us > max_latch_us) { max_latch_us = profile.latch_us; }
+        if (profile.decision_us > 0) {
+            decisions++;
+            total_decision_us += profile.decision_us;
+            if (profile.decision_us > max_decision_us) { max_decision_us = profile.decision_us; }
+            printf("    boot: latch %.3f ms, decision %.3f ms\n", profile.latch_us / 1000.0, profile.decision_us / 1000.0);
+        }
+
+        // Time spent per modem state, powered boots only
+        const uint32_t* state_ms = boot_stats->modem_state_ms;
+        if (state_ms[static_cast<size_t>(ModemState::Booting)] > 0) {
+            printf("    modem: booting %u ms, sim ready %u ms, registered %u ms, sending %u ms%s%s\n",
+                state_ms[static_cast<size_t>(ModemState::Booting)], state_ms[static_cast<size_t>(ModemState::SimReady)],
+                state_ms[static_cast<size_t>(ModemState::Registered)], state_ms[static_cast<size_t>(ModemState::Sending)],
+                (boot_stats->modem_failure != ModemFailure::None) ? ", failed: " : "", 
+                modem_failure_name(boot_stats->modem_failure));
+        }
+        if (state.exit_reason == hal::native::ExitReason::DeepSleep && boot_stats->modem_state_ms[0] + 
+            boot_stats->modem_state_ms[static_cast<size_t>(ModemState::Booting)] > 0) {
+            printf("    standby: modem %s for %.0f s\n", modem_standby_name(boot_stats->modem_standby), 
+                state.sleep_duration_us / 1000000.0);
+        }
+
+        // Modem link, bytes and their time on the wire per session
+        const hal::native::UartStats& uart = boot_stats->uart;
+        if (uart.tx_bytes > 0) {
+            sessions++;
+            total_wire_us += uart.wire_us;
+            printf("    uart: %u baud, %u B out, %u B in, %.3f ms on the wire\n", boot_stats->uart_baud,
+                uart.tx_bytes, uart.rx_bytes, uart.wire_us / 1000.0);
+        }
+
+        // Modelled charge: awake phases (cpu, modem on, sending, led, adc) and the sleep that follows
+        const float* charge = boot_stats->charge;
+        float boot_charge = 0;
+        for (size_t i = 0; i < static_cast<size_t>(energy::Phase::NumOfPhases); i++) { boot_charge += charge[i]; }
+        total_charge += boot_charge;
+        printf("    energy: %.4f mAh (cpu %.4f, modem %.4f, sms %.4f, led %.4f, adc %.4f), sleep %.4f mAh\n",
+            boot_charge - charge[static_cast<size_t>(energy::Phase::Sleep)], charge[0], charge[1], charge[2], 
+            charge[3], charge[4], charge[static_cast<size_t>(energy::Phase::Sleep)]);
+
+        // Injected by the modem stand-in, or its replay against the transcript
+        const SimModem::Faults& faults = boot_stats->faults;
+        if (faults.errors + faults.drops + faults.corrupted_bytes > 0) {
+            printf("    faults: %u commands, %u errors, %u drops, %u bytes corrupted\n", faults.commands, 
+                faults.errors, faults.drops, faults.corrupted_bytes);
+        }
+        total_faults.commands += faults.commands;
+        total_faults.errors += faults.errors;
+        total_faults.drops += faults.drops;
+        total_faults.corrupted_bytes += faults.corrupted_bytes;
+
+        const SimModem::ReplayStats& replay = boot_stats->replay;
+        if (modem.is_replaying() && replay.matched + replay.diverged > 0) {
+            printf("    replay: %u commands matched, %u skipped, %u diverged", replay.matched, replay.skipped, replay.diverged);
+            if (replay.diverged > 0) { printf(" (first at transcript line %u)", replay.first_divergence); }
+            printf("\n");
+        }
+        total_replay.matched += replay.matched;
+        total_replay.skipped += replay.skipped;
+        total_replay.diverged += replay.diverged;
+
+        // Powered through a deep sleep only by a held pad (standby), otherwise cut
+        SimModem::Snapshot& snapshot = boot_stats->modem;
+        snapshot.is_powered = state.exit_reason == hal::native::ExitReason::DeepSleep && 
+            state.gpio_held[PIN_SIM800L_POWER_SWITCH] && state.gpio_level[PIN_SIM800L_POWER_SWITCH] == hal::Level::High;
+        modem.restore(snapshot);
+
+        // First AT+CMGS to last acknowledgement
+        if (boot_stats->sms_sent > 0) {
+            uint64_t sms_us = boot_stats->sms_last_us - boot_stats->sms_first_us;
+            total_sms += boot_stats->sms_sent;
+            total_sms_us += sms_us;
+            printf("    sms: %u recipients in %.3f ms, %.3f recipients/s\n", boot_stats->sms_sent,
+                sms_us / 1000.0, boot_stats->sms_sent * 1000000.0 / sms_us);
+        }
+
+        // Timer wakeup after deepsleep, otherwise the power latch starts the next boot
+        timeline_us += state.exit_time_us;
+        is_reset_boot = (state.exit_reason == hal::native::ExitReason::Reset || 
+            state.exit_reason == hal::native::ExitReason::Restart);
+        if (state.exit_reason == hal::native::ExitReason::Reset) { options.reset_at_us = UINT64_MAX; }
+        if (state.exit_reason == hal::native::ExitReason::DeepSleep) {
+            state.wakeup_cause = hal::WakeupCause::Timer;
+            const bool has_timer = (state.sleep_duration_us > 0);
+            uint64_t sleep_us = has_timer ? state.sleep_duration_us : ULP_WATCH_LIMIT_US;
+
+            if (state.is_ulp_running) {
+                sleep_us = emulate_ulp(state, timeline_us, sleep_us);
+                printf("    ulp: %u readings asleep, %s after %.3f ms\n", state.ulp_state.samples,
+                    (state.wakeup_cause == hal::WakeupCause::Ulp) ? "woke" : "slept on", sleep_us / 1000.0);
+            }
+            timeline_us += sleep_us;
+
+            // Nothing else wakes it, the remaining boots would never happen
+            if (!has_timer && state.wakeup_cause != hal::WakeupCause::Ulp) {
+                printf("    asleep without a timer wake, run ends\n");
+                options.boots = boot;
+                break;
+            }
+        } else {
+            state.wakeup_cause = hal::WakeupCause::Undefined;
+        }
+    }
+
+    if (trace_path) {
+        FILE* file = fopen(trace_path, "a");
+        fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"water-leak-sms-alarm\"}}\n]}\n");
+        fclose(file);
+    }
+
+    printf("boots: %u, awake: %.3f ms total, %.3f ms mean, flash writes: %u\n", options.boots,
+        total_us / 1000.0, total_us / 1000.0 / options.boots, state.flash_writes);
+    printf("heap: %u allocations, %i B high-water\n", total_allocations, peak_bytes);
+    if (decisions > 0) {
+        printf("boot: latch %.3f ms max, decision %.3f ms mean, %.3f ms max\n", max_latch_us / 1000.0,
+            total_decision_us / 1000.0 / decisions, max_decision_us / 1000.0);
+    }
+    if (sessions > 0) {
+        printf("uart: %u sessions, %.3f ms on the wire mean\n", sessions, total_wire_us / 1000.0 / sessions);
+    }
+    printf("energy: %.3f mAh total, %.4f mAh mean per boot\n", total_charge, total_charge / options.boots);
+    if (total_faults.commands > 0 && total_faults.errors + total_faults.drops + total_faults.corrupted_bytes > 0) {
+        printf("faults: %u commands, %u errors, %u drops, %u bytes corrupted\n", total_faults.commands,
+            total_faults.errors, total_faults.drops, total_faults.corrupted_bytes);
+    }
+    if (modem.is_replaying()) {
+        printf("replay: %u commands matched, %u skipped, %u diverged\n", total_replay.matched, total_replay.skipped,
+            total_replay.diverged);
+    }
+    if (total_sms > 0) {
+        printf("sms: %u recipients, %.3f recipients/s\n", total_sms, total_sms * 1000000.0 / total_sms_us);
+    }
+    if (options.dump_events_path) {
+        return dump_events(options.dump_events_path);
+    }
+    return 0;
+}
@@ -0,0 +1,492 @@
+
+#include "native/sim_modem.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// Commands match by their name: "AT+CMGS=25" as "AT+CMGS", an SMS body (Ctrl-Z) as "^Z"
+static std::string command_name(const std::string& command) {
+    if (command.size() >= 2 && command.compare(command.size() - 2, 2, "^Z") == 0) { return "^Z"; }
+    return command.substr(0, command.find_first_of("=?"));
+}
+
+//
+// Public
+//
+
+bool SimModem::preset(const char* name, Profile& profile) {
+    if (strcmp(name, "ideal") == 0) {
+        profile = Profile();
+        return true;
+    }
+
+    // Fringe coverage: slow search and sending, answers late and in pieces
+    if (strcmp(name, "weak") == 0 || strcmp(name, "flaky") == 0) {
+        profile.signal_quality = 8;
+        profile.search_ms = 20000;
+        profile.sms_send_ms = 6000;
+        profile.jitter_ms = 150;
+        profile.fragment_bytes = 8;
+        profile.fragment_gap_us = 2000;
+        profile.select_ack_ms = 800;
+    }
+
+    // On top, a noisy line and a module that misses or refuses now and then
+    if (strcmp(name, "flaky") == 0) {
+        profile.noise_rate = 0.0005f;
+        profile.error_rate = 0.02f;
+        profile.drop_rate = 0.01f;
+    }
+    return strcmp(name, "weak") == 0 || strcmp(name, "flaky") == 0;
+}
+
+
+bool SimModem::load_transcript(const char* path) {
+    FILE* file = fopen(path, "r");
+    if (!file) { return false; }
+
+    // "<ms since power on> <'>' or '<'> <text>", '#' comment. "<" ">" is the SMS prompt,
+    // an SMS body sent by the ESP32 ends with "^Z"
+    char text[1024];
+    uint32_t line_num = 0;
+    while (fgets(text, sizeof(text), file)) {
+        line_num++;
+        text[strcspn(text, "\r\n")] = '\0';
+        char* cursor = text;
+        while (*cursor == ' ' || *cursor == '\t') { cursor++; }
+        if (*cursor == '#' || *cursor == '\0') { continue; }
+
+        char* end = nullptr;
+        const double time_ms = strtod(cursor, &end);
+        while (end != cursor && (*end == ' ' || *end == '\t')) { end++; }
+        if (end == cursor || (*end != '<' && *end != '>')) {
+            fprintf(stderr, "%s:%u: expected \"<ms> > command\" or \"<ms> < response\"\n", path, line_num);
+            continue;
+        }
+        const bool is_from_modem = (*end++ == '<');
+        if (*end == ' ') { end++; }
+        _transcript.push_back({ line_num, static_cast<uint64_t>(time_ms * 1000), is_from_modem, end });
+    }
+    fclose(file);
+    return !_transcript.empty();
+}
+
+
+void SimModem::attach() {
+    hal::native::attach_uart_peer(_port, this);
+    hal::native::set_gpio_hook(on_gpio, this);
+}
+
+
+void SimModem::on_receive(uint8_t byte, uint64_t time_us) {
+    if (!_is_powered) { return; }
+
+    // Fixed rate (AT+IPR): bytes at any other rate are garbled
+    if (_profile.fixed_baud != 0 && hal::native::uart_baud(_port) != _profile.fixed_baud) {
+        _line.clear();
+        return;
+    }
+
+    // Automatic sleep (AT+CSCLK=2) once the UART is quiet: the first byte wakes it, its line is lost
+    constexpr uint64_t SLEEP_IDLE_US = 5000000;
+    if (_sleep_mode == 2 && (_is_asleep || time_us - _last_rx_us >= SLEEP_IDLE_US)) {
+        _is_asleep = false;
+        _is_line_lost = true;
+    }
+    _last_rx_us = time_us;
+
+    // SMS body, ends with Ctrl-Z
+    if (_is_in_sms_body) {
+        if (byte != 26) {
+            _body.push_back(static_cast<char>(byte));
+            return;
+        }
+
+        _is_in_sms_body = false;
+        if (is_replaying()) {
+            replay_command(_body + "^Z", time_us);
+            return;
+        }
+
+        // Lost or refused by the network
+        _faults.commands++;
+        if (draw(_profile.drop_rate)) {
+            _faults.drops++;
+            return;
+        }
+        if (draw(_profile.error_rate)) {
+            _faults.errors++;
+            reply("\r\n+CMS ERROR: 500\r\n", response_time(time_us, _profile.sms_send_ms));
+            return;
+        }
+
+        if (!accept_body()) {
+            reply("\r\n+CMS ERROR: 304\r\n", response_time(time_us, _profile.response_ms));
+            return;
+        }
+        _message_reference++;
+        _last_ack_us = response_time(time_us, _profile.sms_send_ms);
+        reply("\r\n+CMGS: " + std::to_string(_message_reference) + "\r\n\r\nOK\r\n", _last_ack_us);
+        return;
+    }
+
+    // Commands end with '\r', '\n' is ignored
+    if (byte == '\n') { return; }
+    if (byte != '\r') {
+        _line.push_back(static_cast<char>(byte));
+        return;
+    }
+
+    // Still booting or waking, bytes are lost
+    if (time_us < _ready_us || _is_line_lost) {
+        _is_line_lost = false;
+        _line.clear();
+        return;
+    }
+
+    handle_line(_line, time_us);
+    _line.clear();
+}
+
+
+void SimModem::on_poll(uint64_t time_us) {
+    // "+CREG: <stat>" once the search ends (AT+CREG=1)
+    if (_is_powered && _is_creg_urc_on && !_is_creg_reported && _profile.has_sim && time_us >= _registered_us) {
+        _is_creg_reported = true;
+        reply("\r\n+CREG: " + std::to_string(registration_status(time_us)) + "\r\n", _registered_us);
+    }
+
+    // A command the module answers once done with it, behind the URC
+    if (_is_powered && time_us >= _deferred_us) {
+        reply(_deferred, _deferred_us);
+        _deferred_us = UINT64_MAX;
+    }
+}
+
+
+SimModem::Snapshot SimModem::snapshot(uint64_t time_us) const {
+    Snapshot snapshot = {};
+    snapshot.fixed_baud = _profile.fixed_baud;
+    snapshot.is_powered = _is_powered;
+    snapshot.is_echo_on = _is_echo_on;
+    snapshot.is_creg_urc_on = _is_creg_urc_on;
+    snapshot.is_pdu_mode = _is_pdu_mode;
+    snapshot.is_radio_on = _is_radio_on;
+    snapshot.is_registered = (registration_status(time_us) == 1);
+    snapshot.sleep_mode = _sleep_mode;
+    snapshot.message_reference = _message_reference;
+    return snapshot;
+}
+
+
+void SimModem::restore(const Snapshot& snapshot) {
+    _profile.fixed_baud = snapshot.fixed_baud;
+    _is_powered = snapshot.is_powered;
+    if (!_is_powered) { return; }
+
+    // Booted long ago, asleep by now if sleep mode 2 was set
+    _ready_us = 0;
+    _is_echo_on = snapshot.is_echo_on;
+    _is_creg_urc_on = snapshot.is_creg_urc_on;
+    _is_creg_reported = true;
+    _is_pdu_mode = snapshot.is_pdu_mode;
+    _is_radio_on = snapshot.is_radio_on;
+    _registered_us = snapshot.is_registered ? 0 : UINT64_MAX;
+    _sleep_mode = snapshot.sleep_mode;
+    _is_asleep = (_sleep_mode == 2);
+    _message_reference = snapshot.message_reference;
+}
+
+
+void SimModem::on_end() {
+    _line.clear();
+    _body.clear();
+    _is_in_sms_body = false;
+}
+
+//
+// Private
+//
+
+void SimModem::on_gpio(uint8_t pin, hal::Level level, void* context) {
+    SimModem* modem = static_cast<SimModem*>(context);
+    if (pin != modem->_power_pin) { return; }
+
+    const bool powered = (level == hal::Level::High);
+    if (powered && !modem->_is_powered) {
+        const uint64_t power_on_us = hal::native::now_us();
+        modem->_ready_us = power_on_us + modem->_profile.boot_ms * 1000ULL;
+        modem->_registered_us = modem->_profile.has_coverage ? modem->_ready_us + modem->_profile.search_ms * 1000ULL : UINT64_MAX;
+        modem->_is_echo_on = true;
+        modem->_is_radio_on = true;
+        modem->_sleep_mode = 0;
+        modem->_is_asleep = false;
+        modem->_is_line_lost = false;
+        modem->_last_rx_us = power_on_us;
+        modem->_is_creg_urc_on = false;
+        modem->_is_creg_reported = false;
+        modem->_deferred_us = UINT64_MAX;
+        modem->_is_pdu_mode = false;
+
+        // Output of a recorded session up to its first command (e.g. "RDY")
+        modem->_replay_next = 0;
+        modem->replay_until_command(power_on_us, 0);
+    }
+    if (!powered) {
+        hal::native::uart_clear_rx(modem->_port);
+        modem->on_end();
+    }
+    modem->_is_powered = powered;
+}
+
+
+uint32_t SimModem::next_random() {
+    _random ^= _random << 13;
+    _random ^= _random >> 17;
+    _random ^= _random << 5;
+    return _random;
+}
+
+
+bool SimModem::draw(float rate) {
+    return rate > 0 && next_random() < rate * 4294967296.0;
+}
+
+
+uint64_t SimModem::response_time(uint64_t time_us, uint32_t delay_ms) {
+    const uint32_t jitter_ms = (_profile.jitter_ms > 0) ? next_random() % (_profile.jitter_ms + 1) : 0;
+    return time_us + (delay_ms + jitter_ms) * 1000ULL;
+}
+
+
+void SimModem::handle_line(const std::string& command, uint64_t time_us) {
+    if (is_replaying()) {
+        replay_command(command, time_us);
+        return;
+    }
+
+    // One command at a time, the next is answered once the deferred one is
+    if (_deferred_us != UINT64_MAX) {
+        const uint64_t deferred_us = _deferred_us;
+        on_poll(deferred_us);
+        time_us = std::max(time_us, deferred_us);
+    }
+    if (_is_echo_on) {
+        reply(command + "\r", time_us);
+    }
+
+    // Missed or refused now and then
+    _faults.commands++;
+    if (draw(_profile.drop_rate)) {
+        _faults.drops++;
+        return;
+    }
+    if (draw(_profile.error_rate)) {
+        _faults.errors++;
+        reply("\r\nERROR\r\n", response_time(time_us, _profile.response_ms));
+        return;
+    }
+    handle_command(command, response_time(time_us, _profile.response_ms));
+}
+
+
+void SimModem::handle_command(const std::string& command, uint64_t time_us) {
+    if (command == "AT") {
+        reply("\r\nOK\r\n", time_us);
+
+    } else if (command == "AT+CMGF=0" || command == "AT+CMGF=1") {
+        _is_pdu_mode = (command.back() == '0');
+        reply("\r\nOK\r\n", time_us);
+
+    } else if (command == "ATE0") {
+        _is_echo_on = false;
+        reply("\r\nOK\r\n", time_us);
+
+    } else if (command == "AT+CCID") {
+        reply(_profile.has_sim ? "\r\n89460000000000000000\r\n\r\nOK\r\n" : "\r\nERROR\r\n", time_us);
+
+    } else if (command == "AT+CSQ") {
+        reply("\r\n+CSQ: " + std::to_string(_profile.signal_quality) + ",0\r\n\r\nOK\r\n", time_us);
+
+    } else if (command == "ATI") {
+        reply("\r\nSIM800 R14.18\r\n\r\nOK\r\n", time_us);
+
+    } else if (command == "AT+COPS?") {
+        const bool is_registered = (registration_status(time_us) == 1);
+        reply(is_registered ? "\r\n+COPS: 0,0,\"" + std::string(_profile.operator_name) + "\"\r\n\r\nOK\r\n" 
+            : "\r\n+COPS: 0\r\n\r\nOK\r\n", time_us);
+
+    } else if (command == "AT+CREG?") {
+        reply("\r\n+CREG: " + std::to_string(_is_creg_urc_on ? 1 : 0) + "," + 
+            std::to_string(registration_status(time_us)) + "\r\n\r\nOK\r\n", time_us);
+
+    } else if (command == "AT+CREG=1") {
+        _is_creg_urc_on = true;
+        reply("\r\nOK\r\n", time_us);
+
+    } else if (command.rfind("AT+COPS=4,0,\"", 0) == 0) {
+        if (!_profile.has_sim) {
+            reply("\r\nERROR\r\n", time_us);
+            return;
+        }
+        if (!_profile.has_coverage) {
+            reply("\r\n+CME ERROR: 30\r\n", time_us + _profile.select_ms * 1000ULL);
+            return;
+        }
+
+        // Known operator: no band search. Otherwise automatic, completes once registered
+        const size_t start = command.find('"') + 1;
+        const std::string name = command.substr(start, command.find('"', start) - start);
+        if (name == _profile.operator_name) {
+            _registered_us = std::min<uint64_t>(_registered_us, time_us + _profile.select_ms * 1000ULL);
+        }
+        _deferred = _profile.is_denied ? "\r\n+CME ERROR: 30\r\n" : "\r\nOK\r\n";
+        _deferred_us = (_registered_us == UINT64_MAX)
+            ? UINT64_MAX : std::max(time_us, _registered_us) + _profile.select_ack_ms * 1000ULL;
+
+    } else if (command.rfind("AT+IPR=", 0) == 0) {
+        // Answered at the old rate, the new one applies from the next command on
+        constexpr uint32_t RATES[] = { 0, 1200, 2400, 4800, 9600, 19200, 38400, 57600, 115200, 230400, 460800 };
+        const uint32_t baud = std::strtoul(command.c_str() + 7, nullptr, 10);
+        if (std::find(std::begin(RATES), std::end(RATES), baud) == std::end(RATES)) {
+            reply("\r\nERROR\r\n", time_us);
+            return;
+        }
+        reply("\r\nOK\r\n", time_us);
+        _profile.fixed_baud = baud;
+
+    } else if (command == "AT+CSCLK=0" || command == "AT+CSCLK=2") {
+        _sleep_mode = static_cast<uint8_t>(command.back() - '0');
+        reply("\r\nOK\r\n", time_us);
+
+    } else if (command == "AT+CFUN=0") {
+        // Minimum functionality: radio off, deregistered
+        _is_radio_on = false;
+        _registered_us = UINT64_MAX;
+        reply("\r\nOK\r\n", time_us);
+
+    } else if (command == "AT+CFUN=1") {
+        // Radio back on, the last network is found again without a band search
+        if (!_is_radio_on) {
+            _is_radio_on = true;
+            _is_creg_reported = false;
+            _registered_us = _profile.has_coverage ? time_us + _profile.select_ms * 1000ULL : UINT64_MAX;
+        }
+        reply("\r\nOK\r\n", time_us);
+
+    } else if (command == "AT+COPS=0") {
+        reply("\r\nOK\r\n", time_us);
+
+    } else if (command.rfind("AT+CMGS=", 0) == 0) {
+        if (_sms_sent == 0 && _first_cmgs_us == 0) { _first_cmgs_us = time_us; }
+        _tpdu_length = _is_pdu_mode ? std::strtoul(command.c_str() + 8, nullptr, 10) : 0;
+        _is_in_sms_body = true;
+        _body.clear();
+        reply("\r\n> ", time_us);
+
+    } else {
+        reply("\r\nERROR\r\n", time_us);
+    }
+}
+
+
+bool SimModem::accept_body() {
+    if (!_is_pdu_mode) {
+        _sms_sent++;
+        return true;
+    }
+
+    // Hex octets: SMSC length and address, then the TPDU of AT+CMGS=<length>
+    std::vector<uint8_t> octets;
+    for (size_t i = 0; i + 1 < _body.size(); i += 2) {
+        octets.push_back(static_cast<uint8_t>(std::strtoul(_body.substr(i, 2).c_str(), nullptr, 16)));
+    }
+    if (_body.size() % 2 != 0 || octets.empty() || octets.size() != 1 + octets[0] + _tpdu_length) {
+        return false;
+    }
+
+    // First octet, destination (digits, type, semi-octets), PID, DCS, UDL, then the user data header
+    const size_t tpdu = 1 + octets[0];
+    const size_t user_data = tpdu + 4 + (octets[tpdu + 2] + 1) / 2 + 3;
+    const bool has_header = (octets[tpdu] & 0x40) != 0;
+    if (has_header && user_data + 6 <= octets.size() && octets[user_data + 1] == 0x00) {
+        // Concatenated: the phone shows one message once the last part is in
+        const uint8_t parts = octets[user_data + 4];
+        const uint8_t part = octets[user_data + 5];
+        if (part == parts) { _sms_sent++; }
+        return true;
+    }
+    _sms_sent++;
+    return true;
+}
+
+
+int SimModem::registration_status(uint64_t time_us) const {
+    // 0 not searching, 1 home, 2 searching, 3 denied
+    if (!_profile.has_sim || !_is_radio_on) { return 0; }
+    if (time_us < _registered_us) { return 2; }
+    return _profile.is_denied ? 3 : 1;
+}
+
+
+void SimModem::replay_command(const std::string& command, uint64_t time_us) {
+    // The next recorded command of that name, the ones before it were not sent this time
+    const std::string name = command_name(command);
+    size_t index = _replay_next;
+    while (index < _transcript.size() && (_transcript[index].is_from_modem || command_name(_transcript[index].text) != name)) {
+        index++;
+    }
+
+    if (index == _transcript.size()) {
+        if (_replay_stats.diverged++ == 0) {
+            _replay_stats.first_divergence = (_replay_next < _transcript.size()) ? _transcript[_replay_next].line 
+                : _transcript.back().line;
+        }
+        reply("\r\nERROR\r\n", response_time(time_us, _profile.response_ms));
+        return;
+    }
+
+    for (size_t i = _replay_next; i < index; i++) {
+        if (!_transcript[i].is_from_modem) { _replay_stats.skipped++; }
+    }
+    _replay_stats.matched++;
+    if (name == "AT+CMGS" && _sms_sent == 0 && _first_cmgs_us == 0) { _first_cmgs_us = time_us; }
+
+    _replay_next = index + 1;
+    replay_until_command(time_us, _transcript[index].time_us);
+}
+
+
+void SimModem::replay_until_command(uint64_t base_us, uint64_t recorded_us) {
+    // Recorded output up to the next command, as far apart as it was recorded
+    while (_replay_next < _transcript.size() && _transcript[_replay_next].is_from_modem) {
+        const TranscriptLine& entry = _transcript[_replay_next++];
+        const uint64_t time_us = base_us + ((entry.time_us > recorded_us) ? entry.time_us - recorded_us : 0);
+
+        reply((entry.text == ">") ? "\r\n> " : "\r\n" + entry.text + "\r\n", time_us);
+        if (entry.text.rfind("+CMGS:", 0) == 0) {
+            _sms_sent++;
+            _last_ack_us = time_us;
+        }
+    }
+}
+
+
+void SimModem::reply(const std::string& text, uint64_t time_us) {
+    // Noise, then the bytes in chunks when the profile fragments them
+    std::string bytes = text;
+    for (char& byte : bytes) {
+        if (draw(_profile.noise_rate)) {
+            byte = static_cast<char>(next_random() & 0xFF);
+            _faults.corrupted_bytes++;
+        }
+    }
+
+    const size_t chunk = (_profile.fragment_bytes > 0) ? _profile.fragment_bytes : bytes.size();
+    for (size_t start = 0; start < bytes.size(); start += chunk) {
+        const uint64_t chunk_us = time_us + (start / chunk) * _profile.fragment_gap_us;
+        hal::native::uart_inject(_port, reinterpret_cast<const uint8_t*>(bytes.data()) + start, 
+            std::min(chunk, bytes.size() - start), chunk_us);
+    }
+}
@@ -0,0 +1,194 @@
+
+#include "native/wire_decoder.h"
+#include "core/sms_text.h"
+#include <algorithm>
+#include <map>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+namespace wire_decoder {
+
+// One command and its answer, times from the end of the command write
+struct Exchange {
+    uint32_t start_us;
+    std::string name;
+    uint32_t first_us = 0;      // First byte back
+    uint32_t final_us = 0;
+    const char* result = "none";
+};
+
+struct Totals {
+    uint32_t count = 0;
+    uint32_t answered = 0;
+    uint32_t failed = 0;        // ERROR, +CME/+CMS ERROR
+    uint64_t first_us = 0;
+    uint64_t final_us = 0;
+    uint32_t max_first_us = 0;
+    uint32_t max_final_us = 0;
+};
+
+
+// "AT+CMGS=22" -> "AT+CMGS", an SMS body (ends with Ctrl-Z) -> "body"
+static std::string command_name(const std::string& command) {
+    if (!command.empty() && command.back() == sms_text::CTRL_Z) { return "body"; }
+    return command.substr(0, command.find_first_of("=?"));
+}
+
+
+static const char* result_name(const std::string& line) {
+    if (line == "OK")                                           { return "ok"; }
+    if (line == "ERROR" || line.rfind("+CME ERROR", 0) == 0)    { return "error"; }
+    if (line.rfind("+CMS ERROR", 0) == 0)                       { return "cms-error"; }
+    return nullptr;
+}
+
+
+// The escaped bytes after "wire <us> <tx|rx> "
+static std::string unescape(const char* text) {
+    std::string bytes;
+    for (const char* c = text; *c != '\0' && *c != '\n' && *c != '\r'; c++) {
+        if (*c != '\\' || c[1] == '\0') { bytes += *c; continue; }
+
+        c++;
+        if (*c == 'r')          { bytes += '\r'; }
+        else if (*c == 'n')     { bytes += '\n'; }
+        else if (*c == 'x' && c[1] && c[2]) {
+            const char hex[3] = { c[1], c[2], '\0' };
+            bytes += static_cast<char>(strtoul(hex, nullptr, 16));
+            c += 2;
+        } else                  { bytes += *c; }
+    }
+    return bytes;
+}
+
+
+static void print_ms(uint64_t time_us, uint32_t count) {
+    if (count == 0) { printf(" %9s", "-"); return; }
+    printf(" %9.3f", time_us / 1000.0 / count);
+}
+
+
+int decode(const char* path, bool is_csv) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return 1;
+    }
+
+    std::vector<Exchange> exchanges;
+    bool is_pending = false;    // Last exchange waits for its final result
+    bool is_body_next = false;  // After the "> " prompt
+    std::string command;        // Written so far, up to its '\r' (or Ctrl-Z)
+    std::string line;           // Received so far, up to its '\n'
+    uint32_t last_us = 0;
+    size_t num_of_chunks = 0;
+    char text[512];
+
+    while (fgets(text, sizeof(text), file)) {
+        unsigned time_us = 0;
+        char direction[3] = {};
+        int offset = 0;
+        if (sscanf(text, "wire %u %2s %n", &time_us, direction, &offset) != 2 || offset == 0) { continue; }
+        num_of_chunks++;
+
+        // A new boot (clock went back), nothing carries over
+        if (time_us < last_us) {
+            is_pending = false;
+            is_body_next = false;
+            command.clear();
+            line.clear();
+        }
+        last_us = time_us;
+
+        const std::string bytes = unescape(text + offset);
+        if (strcmp(direction, "tx") == 0) {
+            // Tail of a write whose start was overwritten in the ring
+            if (command.empty() && !is_body_next && bytes.rfind("AT", 0) != 0) { continue; }
+            is_body_next = false;
+
+            for (char c : bytes) {
+                command += c;
+                if (c != '\r' && c != sms_text::CTRL_Z) { continue; }
+
+                // A command not answered before the next one stays "none"
+                if (c == '\r') { command.pop_back(); }
+                Exchange exchange;
+                exchange.start_us = time_us;
+                exchange.name = command_name(command);
+                exchanges.push_back(exchange);
+                is_pending = true;
+                command.clear();
+                line.clear();
+            }
+            continue;
+        }
+
+        for (char c : bytes) {
+            Exchange* exchange = is_pending ? &exchanges.back() : nullptr;
+            if (exchange && exchange->first_us == 0) { exchange->first_us = time_us - exchange->start_us; }
+
+            // The SMS prompt "> " has no line end
+            if (c == '>' && line.empty() && exchange) {
+                exchange->final_us = time_us - exchange->start_us;
+                exchange->result = "prompt";
+                is_pending = false;
+                is_body_next = true;
+                continue;
+            }
+            if (c == '\r') { continue; }
+            if (c != '\n') { line += c; continue; }
+
+            const char* result = result_name(line);
+            line.clear();
+            if (result && exchange) {
+                exchange->final_us = time_us - exchange->start_us;
+                exchange->result = result;
+                is_pending = false;
+            }
+        }
+    }
+    fclose(file);
+
+    if (is_csv) {
+        printf("start_us,command,first_byte_ms,final_ms,result\n");
+        for (const Exchange& exchange : exchanges) {
+            printf("%u,%s,%.3f,%.3f,%s\n", exchange.start_us, exchange.name.c_str(), exchange.first_us / 1000.0,
+                exchange.final_us / 1000.0, exchange.result);
+        }
+        return 0;
+    }
+
+    // Per command, slowest on average first
+    std::map<std::string, Totals> totals;
+    for (const Exchange& exchange : exchanges) {
+        Totals& entry = totals[exchange.name];
+        entry.count++;
+        if (strcmp(exchange.result, "none") == 0) { continue; }
+
+        entry.answered++;
+        if (strstr(exchange.result, "error")) { entry.failed++; }
+        entry.first_us += exchange.first_us;
+        entry.final_us += exchange.final_us;
+        entry.max_first_us = std::max(entry.max_first_us, exchange.first_us);
+        entry.max_final_us = std::max(entry.max_final_us, exchange.final_us);
+    }
+    std::vector<std::pair<std::string, Totals>> rows(totals.begin(), totals.end());
+    std::sort(rows.begin(), rows.end(), [](const auto& a, const auto& b) {
+        return a.second.final_us * std::max(b.second.answered, 1u) > b.second.final_us * std::max(a.second.answered, 1u);
+    });
+
+    printf("%-12s %6s %8s %6s %9s %9s %9s %9s\n", "command", "count", "answered", "failed",
+        "first ms", "max", "final ms", "max");
+    for (const auto& [name, entry] : rows) {
+        printf("%-12s %6u %8u %6u", name.c_str(), entry.count, entry.answered, entry.failed);
+        print_ms(entry.first_us, entry.answered);
+        printf(" %9.3f", entry.max_first_us / 1000.0);
+        print_ms(entry.final_us, entry.answered);
+        printf(" %9.3f\n", entry.max_final_us / 1000.0);
+    }
+    printf("%zu commands from %zu chunks\n", exchanges.size(), num_of_chunks);
+    return 0;
+}
+} // Namespace wire_decoder
@@ -0,0 +1,105 @@
+
+#include "trace.h"
+#include <atomic>
+
+namespace trace {
+
+// Spans are recorded from both cores: slots are claimed atomically, nesting is per task
+static Event events[MAX_EVENTS];
+static std::atomic<size_t> num_of_events(0);
+static thread_local uint8_t open_spans = 0;
+
+
+static size_t count() {
+    const size_t recorded = num_of_events.load();
+    return (recorded < MAX_EVENTS) ? recorded : MAX_EVENTS;
+}
+
+
+int begin(const char* name) {
+    const size_t index = num_of_events.fetch_add(1);
+
+    // Full, drop the span
+    if (index >= MAX_EVENTS) {
+        num_of_events.store(MAX_EVENTS);
+        return -1;
+    }
+
+    Event& event = events[index];
+    event.name = name;
+    event.start_us = hal::micros();
+    event.end_us = 0;
+    event.depth = open_spans++;
+
+    return static_cast<int>(index);
+}
+
+
+void end(int index) {
+    if (index < 0 || events[index].end_us != 0) {
+        return;
+    }
+
+    events[index].end_us = hal::micros();
+    if (open_spans > 0) { open_spans--; }
+}
+
+
+size_t get_events(const Event** events_out) {
+    *events_out = events;
+    return count();
+}
+
+
+void format_summary(char* buffer, size_t size) {
+    const size_t recorded = count();
+    size_t length = 0;
+    buffer[0] = '\0';
+
+    // Completed top level spans: "hw 4 modem 3030 net 20"
+    for (size_t i = 0; i < recorded; i++) {
+        const Event& event = events[i];
+        if (event.depth != 0 || event.end_us == 0) {
+            continue;
+        }
+
+        int written = snprintf(buffer + length, size - length, "%s%s %u",
+            (length > 0) ? " " : "", event.name, (event.end_us - event.start_us) / 1000);
+
+        // Truncated, drop the partial entry
+        if (written < 0 || static_cast<size_t>(written) >= size - length) {
+            buffer[length] = '\0';
+            return;
+        }
+        length += written;
+    }
+}
+
+
+void export_chrome_json(FILE* file, int pid, int tid) {
+    const uint32_t now_us = hal::micros();
+    const size_t recorded = count();
+
+    // Complete ("X") events, spans still open end now (e.g. power cut during shutdown)
+    for (size_t i = 0; i < recorded; i++) {
+        const Event& event = events[i];
+        uint32_t end_us = (event.end_us != 0) ? event.end_us : now_us;
+
+        fprintf(file, "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%u,\"dur\":%u,\"pid\":%i,\"tid\":%i},\n",
+            event.name, event.start_us, end_us - event.start_us, pid, tid);
+    }
+}
+
+
+void print() {
+    const size_t recorded = count();
+
+    for (size_t i = 0; i < recorded; i++) {
+        const Event& event = events[i];
+        uint32_t duration_us = (event.end_us != 0) ? event.end_us - event.start_us : 0;
+
+        log("%*s%s: %u us\n", event.depth * 2, "", event.name, duration_us);
+        (void)duration_us;
+    }
+}
+} // Namespace trace
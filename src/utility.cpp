@@ -1,6 +1,8 @@
 
 #include "utility.h"
 #include "core/hardware.h"
+#include "core/wire_capture.h"
+#include "trace.h"
 
 namespace util {    
 
@@ -12,23 +14,22 @@ void IRAM_ATTR benchmark(const char* name) {
     // Start timer
 	if (begin_timer) {
         begin_timer = false;
-		start_time = micros();
+		start_time = hal::micros();
         return;
 	}
 
     // Stop timer + output
-    uint end_time = micros() - start_time;
-    String num_str = String(end_time);
+    uint end_time = hal::micros() - start_time;
 
     // Name (if any)
     if (name != nullptr) { log("%s: ", name); }
     
     // Microseconds
-    if (num_str.length() < 4) {
+    if (end_time < 1000) {
         log("%iμs \n", end_time);
 
     // Milliseconds
-    } else if (num_str.length() < 6) {
+    } else if (end_time < 100000) {
         float end_ms = (float)end_time / 1000;
         log("%.3fms \n", end_ms);
     } else {
@@ -45,15 +46,13 @@ void IRAM_ATTR benchmark(const char* name) {
 //
 
 void ESP32_print_wakeup_reason() {
-    esp_sleep_wakeup_cause_t wakeup_reason;
-    wakeup_reason = esp_sleep_get_wakeup_cause();
-
-    switch (wakeup_reason) {
-        case ESP_SLEEP_WAKEUP_EXT0 : log("Wakeup caused by external signal using RTC_IO \n"); break;
-        case ESP_SLEEP_WAKEUP_EXT1 : log("Wakeup caused by external signal using RTC_CNTL \n"); break;
-        case ESP_SLEEP_WAKEUP_TIMER : log("Wakeup caused by timer \n"); break;
-        case ESP_SLEEP_WAKEUP_TOUCHPAD : log("Wakeup caused by touchpad \n"); break;
-        case ESP_SLEEP_WAKEUP_ULP : log("Wakeup caused by ULP program \n"); break;
+    switch (hal::wakeup_cause()) {
+        case hal::WakeupCause::Ext0 : log("Wakeup caused by external signal using RTC_IO \n"); break;
+        case hal::WakeupCause::Ext1 : log("Wakeup caused by external signal using RTC_CNTL \n"); break;
+        case hal::WakeupCause::Timer : log("Wakeup caused by timer \n"); break;
+        case hal::WakeupCause::Touchpad : log("Wakeup caused by touchpad \n"); break;
+        case hal::WakeupCause::Ulp : log("Wakeup caused by ULP program, %u readings, last %u \n", 
+            hal::ulp_monitor_state().samples, hal::ulp_monitor_state().last); break;
         default : break;
     }
 }
@@ -61,12 +60,12 @@ void ESP32_print_wakeup_reason() {
 
 void debug_loop(Memory& memory, GsmModule& sms) {
     hardware::led_color(Color::Off);
-    uint32_t timeout = millis() + 5*1000;
+    uint32_t timeout = hal::millis() + 5*1000;
     uint32_t current_time = 0;
 
     log("---- debug_loop() ----\n");
     while (true) {
-        if (Serial.available()) {
+        if (hal::console_available()) {
             debug_USB_serial(memory, sms);
         }
 
@@ -74,9 +73,9 @@ void debug_loop(Memory& memory, GsmModule& sms) {
         #if DEBUG_LOOP_PING
             if (current_time > timeout) {
                 log(".\n"); 
-                timeout = millis() + 5*1000;
+                timeout = hal::millis() + 5*1000;
             }
-            current_time = millis();
+            current_time = hal::millis();
         #endif 
     }
 }
@@ -84,12 +83,12 @@ void debug_loop(Memory& memory, GsmModule& sms) {
 
 void debug_input_gpio_digital(int gpio_num) {
     while (1) {
-        if (digitalRead(gpio_num)) {
+        if (hal::gpio_read(gpio_num) == hal::Level::High) {
             hardware::led_color(Color::Green);
         } else {
             hardware::led_color(Color::Off);
         }
-        delay(1);
+        hal::delay(1);
     }
 }
 
@@ -98,8 +97,8 @@ void debug_input_gpio_analog(int gpio_num) {
     uint value = 0;
     while (1) {
         for (size_t i = 0; i < 25; i++) {
-            value += analogRead(gpio_num);
-            delay(1);
+            value += hal::adc_read(gpio_num);
+            hal::delay(1);
         }
         uint average = value / 25;
         (average > 1) ? hardware::led_color(Color::Green) : hardware::led_color(Color::Off);
@@ -109,8 +108,25 @@ void debug_input_gpio_analog(int gpio_num) {
 }
 
 
+void debug_record_leak_trace() {
+    uint16_t samples[LEAK_MAX_SAMPLES];
+
+    // One line in the native runner's --adc-replay format (first probe), label it 0 (dry) or 1 (wet)
+    const uint8_t pin = LEAK_PROBES[0].pin;
+    hal::gpio_mode(pin, hal::PinMode::InputPulldown);
+    hal::adc_scan(&pin, 1, samples, LEAK_MAX_SAMPLES, LEAK_SAMPLE_INTERVAL);
+    hal::gpio_mode(pin, hal::PinMode::Output);
+
+    log("?");
+    for (size_t i = 0; i < LEAK_MAX_SAMPLES; i++) {
+        log(" %u", samples[i]);
+    }
+    log("\n");
+}
+
+
 void debug_USB_serial(Memory& memory, GsmModule& sms) {
-    char RX_serial = Serial.read();
+    char RX_serial = hal::console_read();
     switch (RX_serial) {
         // Send SMS
         case 'a' : log("> sms.send_message(Alert)\n"); sms.send_message(SMSType::Alert);                        break; 
@@ -118,23 +134,28 @@ void debug_USB_serial(Memory& memory, GsmModule& sms) {
 
         // EEPROM SmsSent 
         case 'z': log("> SmsSent ++ \n"); memory.increment_eeprom_count(MemAddr::SmsSent);                      break;            
-        case 'x': log("> SmsSent: %i \n", memory.get_eeprom_count<uint8_t>(MemAddr::SmsSent));                  break;      
+        case 'x': log("> SmsSent: %i \n", memory.get_eeprom_count<int>(MemAddr::SmsSent));                  break;      
         case 'c': log("> SmsSent reset back to 0 \n"); memory.reset_eeprom_count(MemAddr::SmsSent);             break;
 
         // EEPROM BootCount
         case '1': log("> BootCount ++ \n"); memory.increment_eeprom_count(MemAddr::BootCount);                  break;            
-        case '2': log("> BootCount: %i \n", memory.get_eeprom_count<uint8_t>(MemAddr::BootCount));              break;      
+        case '2': log("> BootCount: %i \n", memory.get_eeprom_count<int>(MemAddr::BootCount));              break;      
         case '3': log("> BootCount reset back to 0 \n"); memory.reset_eeprom_count(MemAddr::BootCount);         break;
+        case 'w': log("> Flush counters \n"); memory.flush();                                                   break;
 
         // Misc
         case '4': log(">\n");                                                                                   break;
-        case '5': log("> Deepsleep! \n"); delay(1000); hardware::deepsleep(10);                         	break;
-        case '6': log("> Rebooting\n"); delay(1000); ESP.restart();                                             break;
+        case 't': log("> Trace\n"); trace::print();                                                             break;
+        case 'u': log("> Modem UART capture\n"); wire_capture::print();                                        break;
+        case 'l': log("> Leak ADC trace\n"); debug_record_leak_trace();                                         break;
+        case 'h': log("> Heap: %i B in use, %i B peak\n", hal::heap_stats().in_use_bytes, hal::heap_stats().peak_bytes); break;
+        case '5': log("> Deepsleep! \n"); hal::delay(1000); hardware::deepsleep(10);                         	break;
+        case '6': log("> Rebooting\n"); hal::delay(1000); hal::restart();                                             break;
         case '7': log("> sms.begin()\n"); sms.begin();                                                          break;
         case '8': log("> GSM power off\n"); sms.power_off();                                                    break;
         case '9': log("> ALL power off!\n"); 
-            digitalWrite(PIN_CIRCUIT_POWER_SWITCH, HIGH); delay(1000);
-            log("Resetting\n"); digitalWrite(PIN_CIRCUIT_POWER_SWITCH, LOW);               
+            hal::gpio_write(PIN_CIRCUIT_POWER_SWITCH, hal::Level::High); hal::delay(1000);
+            log("Resetting\n"); hal::gpio_write(PIN_CIRCUIT_POWER_SWITCH, hal::Level::Low);               
             break;
 
         default: 